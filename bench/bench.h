@@ -0,0 +1,36 @@
+/*
+ * bench.h
+ *
+ * Marker protocol of the cycle benchmark, shared by the benchmark firmware (bench_main.c,
+ * through HAL_BENCH_MARK() of hal.h) and the simavr runner (simavr_bench.c).
+ *
+ * Every marker is a byte written to EEDR. BENCH_START pushes the current cycle count, a metric
+ * marker pops it and adds the elapsed cycles to the metric, so measured sections can be nested
+ * (displayScene() contains LcdUpdate()). The other markers below 0x10 are events. The flush events
+ * only count the cycles the LCD driver runs, wherever it is called from, so that the transfer of
+ * a LCD_SPI_INTERRUPT frame in the background is counted as well.
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+// events
+#define BENCH_START           0x01 // start of a measured section
+#define BENCH_HALT            0x02 // HAL_HALT(): game over or a failed assert
+#define BENCH_DONE            0x03 // all scenarios finished
+#define BENCH_GAMEPLAY        0x04 // the gameplay scenario starts, the runner drives the buttons from now on
+#define BENCH_FAIL            0x05 // a scenario did not do what it was set up for
+#define BENCH_FLUSH_FRAME     0x06 // LcdUpdate() starts a frame, as BENCH_FLUSH_BEGIN
+#define BENCH_FLUSH_BEGIN     0x07 // the driver starts sending: LcdUpdate(), the SPI interrupt, LcdUpdatePoll()
+#define BENCH_FLUSH_END       0x08 // the driver stops sending until its next BENCH_FLUSH_BEGIN
+
+// metrics, each one closes the section opened by the last BENCH_START
+#define BENCH_CALIBRATE       0x10 // empty section: the cost of the markers themselves
+#define BENCH_LCD_UPDATE      0x11 // LcdUpdate() called by displayScene()
+#define BENCH_DISPLAY_SCENE   0x12
+#define BENCH_CAN_PLACE       0x13 // canPlaceTetromino(), + TStoreMode (check, store, draw)
+#define BENCH_MOVE_DOWN       0x16 // moveTetrominoDown() which only moves the tetromino
+#define BENCH_LOCK            0x17 // moveTetrominoDown() which stores the tetromino, + number of cleared lines (0-3)
+#define BENCH_GAME_STEP       0x1B // one pass of the game loop in the gameplay scenario
+
+#endif /* BENCH_H_ */
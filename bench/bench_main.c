@@ -0,0 +1,197 @@
+/*
+ * bench_main.c
+ *
+ * Benchmark firmware: the game compiled with TETRIS_BENCH, which drops main() of main.c and
+ * enables the markers of bench.h. It runs fixed scenarios for every hot path on prepared
+ * boards, then plays BENCH_GAME_STEPS passes of the game loop with the buttons driven by the
+ * simavr runner.
+ */
+
+#include "../tetris/main.c"
+
+#define BENCH_GAME_STEPS 2000
+
+static uint8_t benchMatrix[16]; // game state saved by benchSave()
+static uint8_t benchScore;
+static uint8_t benchCurrent;
+static uint8_t benchPosition;
+static uint8_t benchNext;
+static volatile bool benchResult; // keeps the results of the measured calls alive
+
+static void benchSave()
+{
+	memcpy(benchMatrix, matrix, sizeof(matrix));
+	benchScore = g_score;
+	benchCurrent = currentTetromino;
+	benchPosition = currentTetrominoPosition;
+	benchNext = nextTetromino;
+}
+
+static void benchRestore()
+{
+	memcpy(matrix, benchMatrix, sizeof(matrix));
+	g_score = benchScore;
+	currentTetromino = benchCurrent;
+	currentTetrominoPosition = benchPosition;
+	nextTetromino = benchNext;
+#ifdef COLUMN_HEIGHTS
+	computeColumnHeights();
+#endif
+	ROWS_CHANGED(0xFFFF);
+	SCENE_CHANGED();
+}
+
+// a half filled well: rows 8-15 with holes in every column
+static void benchBoard()
+{
+	uint8_t row;
+	memset(matrix, 0, sizeof(matrix));
+	for (row = 8; row < 16; ++row)
+	{
+		matrix[row] = (row & 1) ? 0xDB : 0x6D;
+	}
+	currentTetromino = 5*4; // T
+	currentTetrominoPosition = 3 + 8*2;
+	nextTetromino = 1*4; // J
+	g_score = 0;
+#ifdef COLUMN_HEIGHTS
+	computeColumnHeights();
+#endif
+	ROWS_CHANGED(0xFFFF);
+	SCENE_CHANGED();
+}
+
+static void benchCanPlace()
+{
+	uint8_t tetromino;
+	uint8_t position;
+	benchBoard();
+	benchSave();
+	for (tetromino = 0; tetromino < 8*4; ++tetromino)
+	{
+		for (position = 0; position < 128; ++position)
+		{
+			bool result;
+			HAL_BENCH_MARK(BENCH_START);
+			result = canPlaceTetromino(tetromino, position, check);
+			HAL_BENCH_MARK(BENCH_CAN_PLACE + check);
+			benchResult = result;
+			if (result)
+			{
+				HAL_BENCH_MARK(BENCH_START);
+				canPlaceTetromino(tetromino, position, store);
+				HAL_BENCH_MARK(BENCH_CAN_PLACE + store);
+				benchRestore();
+
+				HAL_BENCH_MARK(BENCH_START);
+				canPlaceTetromino(tetromino, position, draw);
+				HAL_BENCH_MARK(BENCH_CAN_PLACE + draw);
+			}
+		}
+	}
+}
+
+static void benchMoveDown()
+{
+	uint8_t tetromino;
+	for (tetromino = 0; tetromino < 8*4; ++tetromino)
+	{
+		memset(matrix, 0, sizeof(matrix));
+#ifdef COLUMN_HEIGHTS
+		computeColumnHeights();
+#endif
+		currentTetromino = tetromino;
+		currentTetrominoPosition = 3;
+		HAL_BENCH_MARK(BENCH_START);
+		moveTetrominoDown();
+		HAL_BENCH_MARK(BENCH_MOVE_DOWN);
+	}
+}
+
+// a vertical I (3 blocks) on the bottom of column "x", the "lines" bottom rows are full except for that column
+static void benchLock()
+{
+	uint8_t lines;
+	uint8_t x;
+	for (lines = 0; lines <= 3; ++lines)
+	{
+		for (x = 0; x < 8; ++x)
+		{
+			uint8_t row;
+			memset(matrix, 0, sizeof(matrix));
+			for (row = 16 - lines; row < 16; ++row)
+			{
+				matrix[row] = ~(0x80 >> x);
+			}
+			currentTetromino = 0*4 + 1; // vertical I
+			currentTetrominoPosition = x + 8*13;
+			g_score = 0;
+#ifdef COLUMN_HEIGHTS
+			computeColumnHeights();
+#endif
+			HAL_BENCH_MARK(BENCH_START);
+			moveTetrominoDown();
+			HAL_BENCH_MARK(BENCH_LOCK + lines);
+			if (g_score != lines)
+			{
+				HAL_BENCH_MARK(BENCH_FAIL);
+			}
+		}
+	}
+}
+
+// the T moves left and right over the half filled well, so every frame differs from the previous one
+static void benchDisplayScene()
+{
+	uint8_t frame;
+	benchBoard();
+	for (frame = 0; frame < 32; ++frame)
+	{
+		LcdWaitForUpdate(); // the transfer in the background is counted by lcd_flush, not by display_scene
+		currentTetrominoPosition = (frame & 1) ? 2 + 8*2 : 3 + 8*2;
+		SCENE_CHANGED();
+		HAL_BENCH_MARK(BENCH_START);
+		displayScene();
+		HAL_BENCH_MARK(BENCH_DISPLAY_SCENE);
+	}
+}
+
+int main()
+{
+	uint8_t i;
+	gameInit();
+
+	for (i = 0; i < 16; ++i)
+	{
+		HAL_BENCH_MARK(BENCH_START);
+		HAL_BENCH_MARK(BENCH_CALIBRATE);
+	}
+	benchCanPlace();
+	benchMoveDown();
+	benchLock();
+	benchDisplayScene();
+
+	// gameplay: the runner sets the buttons after every BENCH_GAME_STEP marker
+	memset(matrix, 0, sizeof(matrix));
+	g_score = 0;
+#ifdef COLUMN_HEIGHTS
+	computeColumnHeights();
+#endif
+	ROWS_CHANGED(0xFFFF);
+	randomizeNextTetromino();
+	HAL_BENCH_MARK(BENCH_GAMEPLAY);
+	for (uint16_t step = BENCH_GAME_STEPS; step; --step)
+	{
+		HAL_BENCH_MARK(BENCH_START);
+		gameStep();
+		HAL_BENCH_MARK(BENCH_GAME_STEP);
+#ifdef IDLE_SLEEP
+		idle(); // the runner counts the sleeping cycles for the duty cycle
+#endif
+	}
+	HAL_BENCH_MARK(BENCH_DONE);
+	while (1)
+	{
+	}
+	return 0;
+}
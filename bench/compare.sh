@@ -0,0 +1,32 @@
+#!/bin/sh
+# usage: compare.sh baseline.tsv results.tsv [tolerance_percent]
+#
+# Compares the mean column of every metric found in both tables and fails when a metric got
+# more than tolerance_percent (default 2) worse than its baseline.
+
+baseline=$1
+results=$2
+tolerance=${3:-2}
+
+if [ ! -f "$baseline" ]; then
+	echo "$baseline not found, create it with 'make baseline'" >&2
+	exit 2
+fi
+
+awk -F'\t' -v tolerance="$tolerance" '
+	FNR == 1 { next }
+	NR == FNR { base[$1] = $4; next }
+	{
+		if (!($1 in base)) {
+			printf "%-28s %12s -> %12.1f  new\n", $1, "", $4
+			next
+		}
+		limit = base[$1] * (1 + tolerance / 100)
+		status = ($4 > limit) ? "REGRESSION" : "ok"
+		if ($4 > limit) {
+			failed = 1
+		}
+		printf "%-28s %12.1f -> %12.1f  %s\n", $1, base[$1], $4, status
+	}
+	END { exit failed }
+' "$baseline" "$results"
@@ -0,0 +1,417 @@
+/*
+ * simavr_bench.c
+ *
+ * Runs the benchmark firmware (bench_main.c) in simavr and turns the markers of bench.h into a
+ * table of cycle counts, one line per metric:
+ *
+ *   metric  count  min  mean  max
+ *
+ * The cost of the markers (the minimum of "calibrate") is subtracted from every section.
+ * The firmware is run once per scenario file. A scenario scripts the buttons of the gameplay
+ * part, one "<steps> <buttons>" line per phase, where buttons are any of L, R, D, U (rotation)
+ * or - for none, e.g. "12 L" holds the left button for 12 passes of the game loop. The script
+ * is repeated until the firmware finishes or the game is over. The fixed scenarios are
+ * reported from the first run only, the gameplay one as "game_step/<scenario name>".
+ *
+ * The cycles of the gameplay part which the CPU spends asleep (IDLE_SLEEP builds) are counted
+ * too, and the rest is reported as "duty_cycle/<scenario name>": the active time in percent,
+ * in all three columns. Without IDLE_SLEEP it is 100.
+ *
+ * "lcd_flush" (fixed scenarios) and "lcd_flush/<scenario name>" (gameplay) count the cycles the
+ * LCD driver runs per frame between the flush markers, from LcdUpdate() until the next frame.
+ * With LCD_SPI_INTERRUPT this includes the SPI interrupts and the runs started from the main
+ * loop, which the other metrics see only as time taken from whatever they interrupt.
+ *
+ *   ./simavr_bench tetris_bench.elf scenarios/idle.txt scenarios/play.txt
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libgen.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "avr_ioport.h"
+#include "bench.h"
+
+#define MCU "atmega8"
+#define FREQUENCY 8000000
+#define EEDR_ADDRESS 0x3D // data space address of EEDR (I/O 0x1D) on the ATmega8
+#define CYCLE_LIMIT 16000000000ULL // about 33 minutes of simulated time, a sleeping CPU plays slower
+#define MAX_PHASES 256
+#define MAX_DEPTH 8
+
+typedef struct
+{
+	uint32_t steps;
+	uint8_t buttons; // PIND bits: PD0 left, PD1 down, PD2 right, PD3 rotation
+} Phase;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+} Metric;
+
+static Metric metrics[256];
+static avr_cycle_count_t startCycles[MAX_DEPTH];
+static int depth;
+static int finished; // BENCH_DONE or BENCH_HALT seen
+static int halted;
+static int failures;
+static int errors;
+static int inGameplay; // between BENCH_GAMEPLAY and BENCH_DONE or BENCH_HALT
+static avr_cycle_count_t gameplayStart;
+static uint64_t gameplayCycles;
+static uint64_t sleepCycles; // cycles of the gameplay spent in a sleep mode
+static Metric flushMetrics[2]; // lcd_flush of the fixed scenarios and of the gameplay
+static int flushDepth; // the flush markers nest when the SPI interrupt comes in LcdUpdate()
+static int flushFrame; // a frame is being counted
+static avr_cycle_count_t flushStart;
+static uint64_t flushCycles; // of the frame being counted
+
+static Phase phases[MAX_PHASES];
+static int phaseCount;
+static int phase;
+static uint32_t phaseSteps;
+static avr_irq_t *buttonIrq[4];
+
+static const char *metricName(uint8_t id)
+{
+	static char name[32];
+	switch (id)
+	{
+		case BENCH_CALIBRATE: return "calibrate";
+		case BENCH_LCD_UPDATE: return "lcd_update";
+		case BENCH_DISPLAY_SCENE: return "display_scene";
+		case BENCH_CAN_PLACE + 0: return "can_place_check";
+		case BENCH_CAN_PLACE + 1: return "can_place_store";
+		case BENCH_CAN_PLACE + 2: return "can_place_draw";
+		case BENCH_MOVE_DOWN: return "move_down";
+		case BENCH_GAME_STEP: return "game_step";
+	}
+	if ((id >= BENCH_LOCK) && (id <= BENCH_LOCK + 3))
+	{
+		snprintf(name, sizeof(name), "lock_%d_lines", id - BENCH_LOCK);
+		return name;
+	}
+	snprintf(name, sizeof(name), "metric_%02x", id);
+	return name;
+}
+
+static void setButtons(avr_t *avr, uint8_t buttons)
+{
+	(void)avr;
+	for (int pin = 0; pin < 4; ++pin)
+	{
+		avr_raise_irq(buttonIrq[pin], (buttons >> pin) & 1); // a pressed button reads as 1
+	}
+}
+
+static void nextGameStep(avr_t *avr)
+{
+	if (!phaseCount)
+	{
+		return;
+	}
+	while (phaseSteps >= phases[phase].steps)
+	{
+		phaseSteps = 0;
+		phase = (phase + 1) % phaseCount;
+	}
+	++phaseSteps;
+	setButtons(avr, phases[phase].buttons);
+}
+
+static void addCycles(Metric *metric, uint64_t cycles)
+{
+	if (!metric->count || cycles < metric->min)
+	{
+		metric->min = cycles;
+	}
+	if (cycles > metric->max)
+	{
+		metric->max = cycles;
+	}
+	metric->sum += cycles;
+	++metric->count;
+}
+
+// the flush cycles of a frame end with the next frame or with the part of the run it belongs to
+static void endFlushFrame(void)
+{
+	if (flushFrame)
+	{
+		addCycles(&flushMetrics[inGameplay], flushCycles);
+		flushFrame = 0;
+		flushCycles = 0;
+	}
+}
+
+static void markerWrite(avr_t *avr, avr_io_addr_t addr, uint8_t value, void *param)
+{
+	(void)param;
+	avr->data[addr] = value;
+
+	if (value == BENCH_START)
+	{
+		if (depth == MAX_DEPTH)
+		{
+			fprintf(stderr, "markers nested too deep\n");
+			++errors;
+			finished = 1;
+			return;
+		}
+		startCycles[depth++] = avr->cycle;
+	}
+	else if (value >= BENCH_CALIBRATE)
+	{
+		if (!depth)
+		{
+			fprintf(stderr, "%s closed without BENCH_START\n", metricName(value));
+			++errors;
+			return;
+		}
+		addCycles(&metrics[value], avr->cycle - startCycles[--depth]);
+		if (value == BENCH_GAME_STEP)
+		{
+			nextGameStep(avr);
+		}
+	}
+	else if ((value == BENCH_FLUSH_FRAME) || (value == BENCH_FLUSH_BEGIN))
+	{
+		if (value == BENCH_FLUSH_FRAME)
+		{
+			endFlushFrame();
+			flushFrame = 1;
+		}
+		if (!flushDepth++)
+		{
+			flushStart = avr->cycle;
+		}
+	}
+	else if (value == BENCH_FLUSH_END)
+	{
+		if (!flushDepth)
+		{
+			fprintf(stderr, "BENCH_FLUSH_END without BENCH_FLUSH_BEGIN\n");
+			++errors;
+			return;
+		}
+		if (!--flushDepth)
+		{
+			flushCycles += avr->cycle - flushStart;
+		}
+	}
+	else if (value == BENCH_GAMEPLAY)
+	{
+		endFlushFrame();
+		inGameplay = 1;
+		gameplayStart = avr->cycle;
+		phase = 0;
+		phaseSteps = 0;
+		nextGameStep(avr);
+	}
+	else if (value == BENCH_FAIL)
+	{
+		++failures;
+	}
+	else if ((value == BENCH_HALT) || (value == BENCH_DONE))
+	{
+		endFlushFrame();
+		if (inGameplay)
+		{
+			inGameplay = 0;
+			gameplayCycles = avr->cycle - gameplayStart;
+		}
+		halted = (value == BENCH_HALT);
+		finished = 1;
+	}
+}
+
+static int loadScenario(const char *path)
+{
+	FILE *file = fopen(path, "r");
+	char line[128];
+
+	if (!file)
+	{
+		perror(path);
+		return -1;
+	}
+	phaseCount = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		unsigned long steps;
+		char buttons[16];
+		if ((line[0] == '#') || (sscanf(line, "%lu %15s", &steps, buttons) != 2))
+		{
+			continue;
+		}
+		if (phaseCount == MAX_PHASES)
+		{
+			fprintf(stderr, "%s: too many phases\n", path);
+			break;
+		}
+		Phase *p = &phases[phaseCount++];
+		p->steps = (uint32_t)steps;
+		p->buttons = 0;
+		for (char *c = buttons; *c; ++c)
+		{
+			switch (*c)
+			{
+				case 'L': p->buttons |= 1 << 0; break;
+				case 'D': p->buttons |= 1 << 1; break;
+				case 'R': p->buttons |= 1 << 2; break;
+				case 'U': p->buttons |= 1 << 3; break;
+			}
+		}
+	}
+	fclose(file);
+	if (!phaseCount)
+	{
+		fprintf(stderr, "%s: no phases\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static int run(const char *elf)
+{
+	elf_firmware_t firmware;
+	memset(&firmware, 0, sizeof(firmware));
+	if (elf_read_firmware(elf, &firmware))
+	{
+		fprintf(stderr, "%s: cannot read the firmware\n", elf);
+		return -1;
+	}
+	firmware.frequency = FREQUENCY;
+
+	avr_t *avr = avr_make_mcu_by_name(MCU);
+	if (!avr)
+	{
+		fprintf(stderr, "simavr does not support %s\n", MCU);
+		return -1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr, &firmware);
+	avr_register_io_write(avr, EEDR_ADDRESS, markerWrite, NULL);
+	for (int pin = 0; pin < 4; ++pin)
+	{
+		buttonIrq[pin] = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), pin);
+	}
+	setButtons(avr, 0);
+
+	memset(metrics, 0, sizeof(metrics));
+	memset(flushMetrics, 0, sizeof(flushMetrics));
+	flushDepth = 0;
+	flushFrame = 0;
+	flushCycles = 0;
+	depth = 0;
+	finished = 0;
+	halted = 0;
+	inGameplay = 0;
+	gameplayCycles = 0;
+	sleepCycles = 0;
+	int state = cpu_Running;
+	while (!finished && (state != cpu_Done) && (state != cpu_Crashed))
+	{
+		int sleeping = (state == cpu_Sleeping); // the run below skips the cycles to the next interrupt
+		avr_cycle_count_t before = avr->cycle;
+		state = avr_run(avr);
+		if (sleeping && inGameplay)
+		{
+			sleepCycles += avr->cycle - before;
+		}
+		if (avr->cycle > CYCLE_LIMIT)
+		{
+			fprintf(stderr, "%s: no BENCH_DONE within %llu cycles\n", elf, CYCLE_LIMIT);
+			++errors;
+			break;
+		}
+	}
+	if (state == cpu_Crashed)
+	{
+		fprintf(stderr, "%s: the simulated CPU crashed\n", elf);
+		++errors;
+	}
+	avr_terminate(avr);
+	return 0;
+}
+
+static void printMetric(const char *name, const Metric *metric, uint64_t overhead)
+{
+	if (!metric->count)
+	{
+		return;
+	}
+	uint64_t min = metric->min - overhead;
+	uint64_t max = metric->max - overhead;
+	double mean = (double)metric->sum / metric->count - overhead;
+	printf("%s\t%llu\t%llu\t%.1f\t%llu\n", name, (unsigned long long)metric->count,
+			(unsigned long long)min, mean, (unsigned long long)max);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: %s tetris_bench.elf scenario.txt...\n", argv[0]);
+		return 2;
+	}
+
+	printf("metric\tcount\tmin\tmean\tmax\n");
+	for (int i = 2; i < argc; ++i)
+	{
+		if (loadScenario(argv[i]) || run(argv[1]))
+		{
+			return 1;
+		}
+		uint64_t overhead = metrics[BENCH_CALIBRATE].count ? metrics[BENCH_CALIBRATE].min : 0;
+		if (i == 2)
+		{
+			for (int id = BENCH_CALIBRATE + 1; id < 256; ++id)
+			{
+				if (id != BENCH_GAME_STEP)
+				{
+					printMetric(metricName(id), &metrics[id], overhead);
+				}
+			}
+			printMetric("lcd_flush", &flushMetrics[0], 0);
+		}
+
+		char scenario[256];
+		char *path = strdup(argv[i]);
+		snprintf(scenario, sizeof(scenario), "game_step/%s", basename(path));
+		free(path);
+		char *extension = strrchr(scenario, '.');
+		if (extension)
+		{
+			*extension = '\0';
+		}
+		printMetric(scenario, &metrics[BENCH_GAME_STEP], overhead);
+		char flush[256];
+		snprintf(flush, sizeof(flush), "lcd_flush/%s", scenario + strlen("game_step/"));
+		printMetric(flush, &flushMetrics[1], 0);
+		if (gameplayCycles)
+		{
+			double duty = 100.0 * (gameplayCycles - sleepCycles) / gameplayCycles;
+			printf("duty_cycle/%s\t1\t%.2f\t%.2f\t%.2f\n", scenario + strlen("game_step/"), duty, duty, duty);
+		}
+		if (halted)
+		{
+			fprintf(stderr, "%s: game over after %llu steps\n", scenario,
+					(unsigned long long)metrics[BENCH_GAME_STEP].count);
+		}
+	}
+
+	if (failures)
+	{
+		fprintf(stderr, "%d scenario checks failed\n", failures);
+	}
+	return (failures || errors) ? 1 : 0;
+}
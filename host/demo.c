@@ -0,0 +1,55 @@
+/*
+ * demo.c
+ *
+ * Plays games with random button presses on the native build and prints
+ * the score and the number of bytes sent to the LCD.
+ *
+ *   ./tetris_demo [games] [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "tetris_native.h"
+
+static unsigned long lcdBytes;
+
+static void countByte(uint8_t data, uint8_t isData)
+{
+	(void)data;
+	(void)isData;
+	++lcdBytes;
+}
+
+int main(int argc, char *argv[])
+{
+	int games = (argc > 1) ? atoi(argv[1]) : 1;
+	unsigned int seed = (argc > 2) ? (unsigned int)atoi(argv[2]) : 1;
+
+	srand(seed);
+	tetrisSetLcdSink(countByte);
+	for (int game = 0; game < games; ++game)
+	{
+		unsigned long steps = 0;
+
+		lcdBytes = 0;
+		tetrisInit((uint16_t)(seed + game));
+		do
+		{
+			uint8_t buttons = 0;
+			if (rand() % 4 == 0)
+			{
+				static const uint8_t choice[] = { TETRIS_BUTTON_LEFT, TETRIS_BUTTON_RIGHT, TETRIS_BUTTON_ROTATION, TETRIS_BUTTON_DOWN };
+				buttons = choice[rand() % 4];
+			}
+			tetrisSetButtons(buttons);
+			tetrisAdvanceTimer(400); // about 50ms of game time per step
+			tetrisTick();
+			++steps;
+		} while (tetrisStep());
+
+		TetrisState state;
+		tetrisGetState(&state);
+		printf("game %d: score %u, %lu steps, %lu LCD bytes\n", game, state.score, steps, lcdBytes);
+	}
+	return 0;
+}
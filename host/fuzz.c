@@ -0,0 +1,503 @@
+/*
+ * fuzz.c
+ *
+ * Differential fuzzing of the collision, lock and line clear code: random boards, tetrominos and
+ * positions are run through the game core of libtetris.a and through a simple reference model,
+ * and the results must be the same. The cases are:
+ *
+ *   check      canPlaceTetromino() in "check" mode, on any position up to the row below the board
+ *   store      canPlaceTetromino() in "store" mode, on a position where the tetromino fits
+ *   draw       canPlaceTetromino() in "draw" mode, on the board or on NEXT_TETROMINO_POSITION; the pixels
+ *              of LcdCache are compared with 4x4 tiles drawn by the model
+ *   move_down  moveTetrominoDown(): the move, or the lock with the line clear, the score, the next
+ *              tetromino and the game over; then the landing position of another tetromino, which
+ *              covers the column heights of COLUMN_HEIGHTS builds
+ *
+ * A board never holds a full row, as in the game. The cases are made in batches of 4096 from the
+ * seed and the number of the batch, and the batches are shared by the worker threads, so a run
+ * checks the same cases whatever the number of threads. The first mismatch is shrunk by removing
+ * blocks of the board while it still fails, and printed. Exits with 1 on a mismatch.
+ *
+ *   ./fuzz [-n cases] [-j threads] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "tetris_native.h"
+
+#define BATCH_SIZE 4096
+#define CACHE_SIZE 504
+#define MESSAGE_SIZE 160
+
+typedef enum
+{
+	CASE_CHECK,
+	CASE_STORE,
+	CASE_DRAW,
+	CASE_MOVE_DOWN,
+	CASE_KINDS
+} CaseKind;
+
+static const char *kindNames[CASE_KINDS] = { "check", "store", "draw", "move_down" };
+
+typedef struct
+{
+	CaseKind kind;
+	uint8_t tetromino;
+	uint8_t position;
+	uint8_t next; // move_down: the next tetromino
+	uint8_t probe; // move_down: tetromino dropped from the top row after the lock
+	uint8_t probeColumn;
+	uint8_t matrix[16];
+} Case;
+
+static uint64_t caseCount = 10000000;
+static uint32_t seed = 1;
+static uint64_t batchCount;
+static uint64_t nextBatch; // shared by the workers
+static int failed; // a worker found a mismatch
+static pthread_mutex_t reportLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t casesOfKind[CASE_KINDS];
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// ---- reference model ----
+
+// calls "block" for every block of "tetromino" in "position"; stops and returns 0 when it does
+static int forBlocks(uint8_t tetromino, int position, int (*block)(int x, int y, void *context), void *context)
+{
+	uint8_t spec = tetrisTetrominoSpec(tetromino);
+	for (int cell = 0; cell < 8; ++cell)
+	{
+		if ((spec & (0x80 >> cell)) && !block((position & 0x07) + cell % 3, (position >> 3) + cell / 3, context))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int blockFits(int x, int y, void *context)
+{
+	const uint8_t *matrix = context;
+	return (x < 8) && (y < 16) && !(matrix[y] & (0x80 >> x));
+}
+
+static int blockStore(int x, int y, void *context)
+{
+	((uint8_t *)context)[y] |= 0x80 >> x;
+	return 1;
+}
+
+static int blockDraw(int x, int y, void *context)
+{
+	uint8_t *cache = context;
+	int screenX = y * 4;
+	int screenY = 48 - (8 + x * 4) - 4;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			if ((i == 0) || (i == 3) || (j == 0) || (j == 3)) // a square with a blank 2x2 center
+			{
+				cache[tetrisLcdCacheIndex(screenX + i, (screenY + j) >> 3)] |= 1 << ((screenY + j) & 0x07);
+			}
+		}
+	}
+	return 1;
+}
+
+static int blockOnScreen(int x, int y, void *context)
+{
+	(void)context;
+	return (x < 8) && (y < 21);
+}
+
+static int fits(const uint8_t matrix[16], uint8_t tetromino, int position)
+{
+	return forBlocks(tetromino, position, blockFits, (void *)matrix);
+}
+
+// removes the full rows and returns their number
+static int clearRows(uint8_t matrix[16])
+{
+	int to = 15;
+	for (int from = 15; from >= 0; --from)
+	{
+		if (matrix[from] != 0xFF)
+		{
+			matrix[to--] = matrix[from];
+		}
+	}
+	int lines = to + 1;
+	while (to >= 0)
+	{
+		matrix[to--] = 0;
+	}
+	return lines;
+}
+
+static int dropPosition(const uint8_t matrix[16], uint8_t tetromino, int position)
+{
+	while (fits(matrix, tetromino, position + 8))
+	{
+		position += 8;
+	}
+	return position;
+}
+
+// ---- cases ----
+
+static void randomBoard(uint32_t *random, uint8_t matrix[16])
+{
+	int height = xorshift32(random) % 17;
+	int style = xorshift32(random) % 3;
+	memset(matrix, 0, 16);
+	for (int row = 16 - height; row < 16; ++row)
+	{
+		uint8_t line;
+		if (style == 0) // random blocks
+		{
+			line = (uint8_t)xorshift32(random);
+		}
+		else if (style == 1) // nearly full rows, so the lines are cleared often
+		{
+			line = (uint8_t)~(0x80 >> (xorshift32(random) % 8));
+		}
+		else // a stack with overhangs
+		{
+			line = (uint8_t)(xorshift32(random) | xorshift32(random));
+		}
+		if (line == 0xFF)
+		{
+			line &= ~(0x80 >> (xorshift32(random) % 8));
+		}
+		matrix[row] = line;
+	}
+}
+
+// a position where "tetromino" fits; "rest" of 4 times it is the landing position of a column
+static int fittingPosition(uint32_t *random, const uint8_t matrix[16], uint8_t tetromino, int *position)
+{
+	for (int attempt = 0; attempt < 16; ++attempt)
+	{
+		int candidate = xorshift32(random) % 128;
+		if (!(xorshift32(random) % 4))
+		{
+			candidate &= 0x07;
+		}
+		if (fits(matrix, tetromino, candidate))
+		{
+			*position = (xorshift32(random) % 4) ? dropPosition(matrix, tetromino, candidate) : candidate;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void makeCase(uint32_t *random, int drawable, Case *c)
+{
+	while (1)
+	{
+		int position;
+		c->kind = (CaseKind)(xorshift32(random) % CASE_KINDS);
+		if ((c->kind == CASE_DRAW) && !drawable)
+		{
+			c->kind = CASE_CHECK;
+		}
+		c->tetromino = xorshift32(random) % 32;
+		c->next = (xorshift32(random) % 8) << 2;
+		c->probe = xorshift32(random) % 32;
+		c->probeColumn = xorshift32(random) % 8;
+		randomBoard(random, c->matrix);
+		switch (c->kind)
+		{
+			case CASE_CHECK:
+				c->position = xorshift32(random) % 136;
+				return;
+			case CASE_DRAW:
+				if (!(xorshift32(random) % 4))
+				{
+					c->tetromino &= ~0x03; // the preview shows orientation 0
+					c->position = TETRIS_NEXT_POSITION;
+					return;
+				}
+				c->position = xorshift32(random) % 128;
+				if (forBlocks(c->tetromino, c->position, blockOnScreen, NULL))
+				{
+					return;
+				}
+				break;
+			default:
+				if (fittingPosition(random, c->matrix, c->tetromino, &position))
+				{
+					c->position = (uint8_t)position;
+					return;
+				}
+				break;
+		}
+	}
+}
+
+// runs "c" on the game core and on the model; returns 1 and describes the difference on a mismatch
+static int runCase(const Case *c, char *message)
+{
+	TetrisState state;
+	uint8_t expected[16];
+	memset(&state, 0, sizeof(state));
+	state.current = c->tetromino;
+	state.position = c->position;
+	state.next = c->next;
+	memcpy(state.matrix, c->matrix, 16);
+	tetrisSetState(&state);
+	memcpy(expected, c->matrix, 16);
+
+	switch (c->kind)
+	{
+		case CASE_CHECK:
+		{
+			int result = tetrisCanPlace(c->tetromino, c->position, TETRIS_CHECK) != 0;
+			int model = fits(c->matrix, c->tetromino, c->position);
+			if (result != model)
+			{
+				snprintf(message, MESSAGE_SIZE, "returns %d, expected %d", result, model);
+				return 1;
+			}
+			return 0;
+		}
+		case CASE_STORE:
+			tetrisCanPlace(c->tetromino, c->position, TETRIS_STORE);
+			tetrisGetState(&state);
+			forBlocks(c->tetromino, c->position, blockStore, expected);
+			if (memcmp(state.matrix, expected, 16))
+			{
+				snprintf(message, MESSAGE_SIZE, "the stored board differs");
+				return 1;
+			}
+			return 0;
+		case CASE_DRAW:
+		{
+			uint8_t *cache = tetrisLcdCache();
+			uint8_t model[CACHE_SIZE];
+			memset(cache, 0, CACHE_SIZE);
+			memset(model, 0, CACHE_SIZE);
+			tetrisCanPlace(c->tetromino, c->position, TETRIS_DRAW);
+			forBlocks(c->tetromino, c->position, blockDraw, model);
+			for (int i = 0; i < CACHE_SIZE; ++i)
+			{
+				if (cache[i] != model[i])
+				{
+					snprintf(message, MESSAGE_SIZE, "LcdCache[%d] is 0x%02X, expected 0x%02X", i, cache[i], model[i]);
+					return 1;
+				}
+			}
+			return 0;
+		}
+		default:
+			break;
+	}
+
+	// move_down
+	int running = tetrisMoveDown();
+	tetrisGetState(&state);
+	int expectedPosition = c->position + 8;
+	uint8_t expectedCurrent = c->tetromino;
+	int expectedScore = 0;
+	int expectedRunning = 1;
+	if (!fits(expected, c->tetromino, expectedPosition)) // locks
+	{
+		forBlocks(c->tetromino, c->position, blockStore, expected);
+		expectedScore = clearRows(expected);
+		expectedCurrent = c->next;
+		expectedPosition = 3;
+		expectedRunning = fits(expected, c->next, 3);
+	}
+	if (memcmp(state.matrix, expected, 16) || (state.score != expectedScore) || (state.current != expectedCurrent)
+			|| (state.position != expectedPosition) || ((running != 0) != expectedRunning))
+	{
+		snprintf(message, MESSAGE_SIZE, "%s board, score %u (expected %d), tetromino %u at %u (expected %u at %d), %s",
+				memcmp(state.matrix, expected, 16) ? "different" : "same", state.score, expectedScore, state.current,
+				state.position, expectedCurrent, expectedPosition, ((running != 0) == expectedRunning) ? "same game over" : "different game over");
+		return 1;
+	}
+	if (fits(expected, c->probe, c->probeColumn))
+	{
+		int landing = tetrisDropPosition(c->probe, c->probeColumn);
+		int model = dropPosition(expected, c->probe, c->probeColumn);
+		if (landing != model)
+		{
+			snprintf(message, MESSAGE_SIZE, "tetromino %u dropped from column %u lands at %d, expected %d",
+					c->probe, c->probeColumn, landing, model);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// removes blocks of the board one by one as long as the case still fails
+static void shrink(Case *c, char *message)
+{
+	int removed = 1;
+	while (removed)
+	{
+		removed = 0;
+		for (int row = 0; row < 16; ++row)
+		{
+			for (int x = 0; x < 8; ++x)
+			{
+				uint8_t mask = 0x80 >> x;
+				if (!(c->matrix[row] & mask))
+				{
+					continue;
+				}
+				Case smaller = *c;
+				char smallerMessage[MESSAGE_SIZE];
+				smaller.matrix[row] &= ~mask;
+				if (runCase(&smaller, smallerMessage))
+				{
+					*c = smaller;
+					memcpy(message, smallerMessage, MESSAGE_SIZE);
+					removed = 1;
+				}
+			}
+		}
+	}
+}
+
+static void report(const Case *c, const char *message)
+{
+	printf("MISMATCH in %s: tetromino %u (spec 0x%02X) at position %u (x %u, y %u)", kindNames[c->kind], c->tetromino,
+			tetrisTetrominoSpec(c->tetromino), c->position, c->position & 0x07, c->position >> 3);
+	if (c->kind == CASE_MOVE_DOWN)
+	{
+		printf(", next %u, probe %u in column %u", c->next, c->probe, c->probeColumn);
+	}
+	printf("\n%s\nminimal board:\n", message);
+	for (int row = 0; row < 16; ++row)
+	{
+		for (int x = 0; x < 8; ++x)
+		{
+			putchar((c->matrix[row] & (0x80 >> x)) ? '#' : '.');
+		}
+		printf("  0x%02X\n", c->matrix[row]);
+	}
+}
+
+static void *workerMain(void *argument)
+{
+	uint64_t *counts = argument;
+	int drawable = tetrisLcdCache() != NULL;
+	char message[MESSAGE_SIZE];
+
+	tetrisInit((uint16_t)seed);
+	while (!__atomic_load_n(&failed, __ATOMIC_RELAXED))
+	{
+		uint64_t batch = __atomic_fetch_add(&nextBatch, 1, __ATOMIC_RELAXED);
+		if (batch >= batchCount)
+		{
+			break;
+		}
+		uint32_t random = (uint32_t)(seed * 2654435761u) ^ (uint32_t)(batch * 0x9E3779B97F4A7C15ull >> 32) ^ 0x6D2B79F5u;
+		if (!random)
+		{
+			random = 1;
+		}
+		uint64_t first = batch * BATCH_SIZE;
+		for (uint64_t n = first; (n < first + BATCH_SIZE) && (n < caseCount); ++n)
+		{
+			Case c;
+			makeCase(&random, drawable, &c);
+			++counts[c.kind];
+			if (runCase(&c, message))
+			{
+				if (!__atomic_exchange_n(&failed, 1, __ATOMIC_RELAXED)) // the first one is reported
+				{
+					shrink(&c, message);
+					pthread_mutex_lock(&reportLock);
+					printf("case %llu of batch %llu\n", (unsigned long long)n, (unsigned long long)batch);
+					report(&c, message);
+					pthread_mutex_unlock(&reportLock);
+				}
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int threadCount = (cores > 0) ? (int)cores : 1;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:j:s:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': caseCount = strtoull(optarg, NULL, 0); break;
+			case 'j': threadCount = atoi(optarg); break;
+			case 's': seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-n cases] [-j threads] [-s seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (threadCount < 1)
+	{
+		threadCount = 1;
+	}
+	batchCount = (caseCount + BATCH_SIZE - 1) / BATCH_SIZE;
+
+	pthread_t *threads = calloc(threadCount, sizeof(pthread_t));
+	uint64_t (*counts)[CASE_KINDS] = calloc(threadCount, sizeof(*counts));
+	if (!threads || !counts)
+	{
+		perror("calloc");
+		return 1;
+	}
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	for (int i = 0; i < threadCount; ++i)
+	{
+		if (pthread_create(&threads[i], NULL, workerMain, counts[i]))
+		{
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	uint64_t total = 0;
+	for (int i = 0; i < threadCount; ++i)
+	{
+		pthread_join(threads[i], NULL);
+		for (int kind = 0; kind < CASE_KINDS; ++kind)
+		{
+			casesOfKind[kind] += counts[i][kind];
+			total += counts[i][kind];
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+	printf("%llu cases (", (unsigned long long)total);
+	for (int kind = 0; kind < CASE_KINDS; ++kind)
+	{
+		printf("%s%s %llu", kind ? ", " : "", kindNames[kind], (unsigned long long)casesOfKind[kind]);
+	}
+	printf(") on %d threads in %.2fs: %.0f cases/s, %s\n", threadCount, seconds, total / seconds,
+			failed ? "MISMATCH" : "no mismatch");
+	free(counts);
+	free(threads);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * hal_native.c
+ *
+ * Mock I/O of the native (host) build: the state behind the macros of hal_native.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal_native.h"
+
+HAL_THREAD_LOCAL uint8_t halNativeButtons;
+HAL_THREAD_LOCAL uint16_t halNativeTimerCounts;
+HAL_THREAD_LOCAL uint8_t halNativeTickCounts;
+HAL_THREAD_LOCAL void (*halNativeSpiSink)(uint8_t data, uint8_t isData);
+HAL_THREAD_LOCAL uint8_t halNativeLcdData;
+HAL_THREAD_LOCAL uint8_t halNativeSpiInterrupt;
+HAL_THREAD_LOCAL uint8_t halNativeSpiPending;
+HAL_THREAD_LOCAL jmp_buf halNativeHaltJump;
+HAL_THREAD_LOCAL jmp_buf halNativeSleepJump;
+HAL_THREAD_LOCAL uint8_t halNativeLog[HAL_LOG_SIZE];
+HAL_THREAD_LOCAL uint8_t halNativeProfilerCount;
+
+static HAL_THREAD_LOCAL uint16_t entropyState = 1;
+
+void halNativeTimerStart(uint16_t counts)
+{
+	// Timer1 is loaded with 65535-counts, so it overflows after counts+1 prescaler ticks
+	halNativeTimerCounts = counts + 1;
+}
+
+void halNativeTimerAdvance(uint16_t counts)
+{
+	halNativeTimerCounts = (counts < halNativeTimerCounts) ? halNativeTimerCounts - counts : 0;
+}
+
+void halNativeEntropySeed(uint16_t seed)
+{
+	entropyState = seed ? seed : 1; // xorshift never leaves the zero state
+}
+
+uint16_t halEntropyRead(void)
+{
+	// xorshift16 stands in for the noise of the unconnected ADC0 pin
+	entropyState ^= entropyState << 7;
+	entropyState ^= entropyState >> 9;
+	entropyState ^= entropyState << 8;
+	return entropyState & 0x3FF; // 10 bit conversion result
+}
+
+void halNativeSpiWrite(uint8_t data)
+{
+	if (halNativeSpiSink)
+	{
+		halNativeSpiSink(data, halNativeLcdData);
+	}
+}
+
+void halNativeSleep(void)
+{
+	if (halNativeSpiPending)
+	{
+		halNativeSpiPending = 0;
+		return;
+	}
+	longjmp(halNativeSleepJump, 1);
+}
+
+void halNativeHalt(void)
+{
+	longjmp(halNativeHaltJump, 1);
+}
+
+void halNativeAssertFailed(const char *file, int line)
+{
+	fprintf(stderr, "Assert: %s:%d\n", file, line);
+	abort();
+}
+
+char *itoa(int value, char *str, int radix)
+{
+	char digits[sizeof(int) * 8 + 1];
+	unsigned int magnitude = (value < 0 && radix == 10) ? -(unsigned int)value : (unsigned int)value;
+	char *p = str;
+	int n = 0;
+
+	if (value < 0 && radix == 10)
+	{
+		*p++ = '-';
+	}
+	do
+	{
+		unsigned int digit = magnitude % radix;
+		digits[n++] = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+		magnitude /= radix;
+	} while (magnitude);
+	while (n)
+	{
+		*p++ = digits[--n];
+	}
+	*p = '\0';
+	return str;
+}
@@ -0,0 +1,128 @@
+/*
+ * hal_native.h
+ *
+ * Mock I/O of the native (host) build, selected by hal.h when TETRIS_NATIVE is defined.
+ * The game code runs unchanged; the host program sets the buttons, advances the timers,
+ * seeds the entropy source and receives every byte sent to the LCD.
+ */
+
+#ifndef HAL_NATIVE_H_
+#define HAL_NATIVE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+
+// every thread of the host program plays its own game (see tournament.c)
+#define HAL_THREAD_LOCAL __thread
+
+// avr/pgmspace.h: the flash is ordinary memory
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+
+// button bits of PIND
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+
+char *itoa(int value, char *str, int radix);
+
+// buttons
+extern HAL_THREAD_LOCAL uint8_t halNativeButtons;
+#define HAL_BUTTONS() (halNativeButtons)
+
+// gravity timer
+extern HAL_THREAD_LOCAL uint16_t halNativeTimerCounts; // counts left until the timer expires, 0 once expired
+void halNativeTimerStart(uint16_t counts);
+void halNativeTimerAdvance(uint16_t counts); // let "counts" prescaler ticks elapse
+#define HAL_TIMER_START(counts) halNativeTimerStart(counts)
+#define HAL_TIMER_EXPIRED() (halNativeTimerCounts == 0)
+
+// scheduler tick, the host calls halNativeTick() to run the tick interrupt
+extern HAL_THREAD_LOCAL uint8_t halNativeTickCounts;
+#define HAL_TICK_START(counts) (halNativeTickCounts = (counts))
+#define HAL_TICK_VECTOR halNativeTick
+void halNativeTick(void);
+
+// entropy source, a seeded xorshift generator
+void halNativeEntropySeed(uint16_t seed);
+uint16_t halEntropyRead(void);
+#define HAL_ENTROPY_INIT() ((void)0)
+// the free running ADC of ENTROPY_POOL: the host calls halNativeAdcIsr() to run its interrupt
+#define HAL_ENTROPY_START() ((void)0)
+#define HAL_ENTROPY_VECTOR halNativeAdcIsr
+#define HAL_ENTROPY_SAMPLE() halEntropyRead()
+#define HAL_ENTROPY_WAIT() halNativeAdcIsr() // nothing runs in the background
+void halNativeAdcIsr(void);
+
+// storage of the input log (INPUT_LOG), a replay runs at full speed
+#define HAL_LOG_SIZE 65535
+extern HAL_THREAD_LOCAL uint8_t halNativeLog[HAL_LOG_SIZE];
+#define HAL_LOG_READ(index) (halNativeLog[(index)])
+#define HAL_LOG_SAVE(buffer, size) memcpy(halNativeLog, (buffer), (size))
+#define HAL_REPLAY_PACING 0
+
+// SPI byte sink: every byte goes to halNativeSpiSink with the state of the D/C pin
+extern HAL_THREAD_LOCAL void (*halNativeSpiSink)(uint8_t data, uint8_t isData);
+extern HAL_THREAD_LOCAL uint8_t halNativeLcdData; // D/C pin
+extern HAL_THREAD_LOCAL uint8_t halNativeSpiInterrupt; // SPI interrupt enabled
+extern HAL_THREAD_LOCAL uint8_t halNativeSpiPending; // an SPI interrupt has run since the last sleep
+void halNativeSpiWrite(uint8_t data);
+#define HAL_SPI_INIT() ((void)0)
+#define HAL_SPI_INIT_CLK2() ((void)0)
+#define HAL_SPI_WRITE(data) halNativeSpiWrite(data)
+#define HAL_SPI_WAIT() ((void)0)
+#define HAL_SPI_CLEAR_FLAG() ((void)0)
+// the transfers complete immediately, so the interrupt runs until the frame in flight is sent
+#define HAL_SPI_INTERRUPT_ENABLE() \
+	do { \
+		halNativeSpiInterrupt = 1; \
+		while (halNativeSpiInterrupt) \
+		{ \
+			halNativeSpiIsr(); \
+		} \
+	} while (0)
+#define HAL_SPI_INTERRUPT_DISABLE() (halNativeSpiInterrupt = 0, halNativeSpiPending = 1) // the last interrupt is pending for a sleep
+#define HAL_SPI_VECTOR halNativeSpiIsr
+void halNativeSpiIsr(void);
+
+// LCD control pins
+#define HAL_LCD_INIT_PINS() ((void)0)
+#define HAL_LCD_DATA_MODE() (halNativeLcdData = 1)
+#define HAL_LCD_COMMAND_MODE() (halNativeLcdData = 0)
+
+// idle (IDLE_SLEEP): a sleep ends at once when an SPI interrupt has run since the last one, as the interrupt would
+// wake the CPU; otherwise only the next tick would, and the sleep longjmps to halNativeSleepJump (see tetrisStep())
+#define HAL_SLEEP_INIT() ((void)0)
+#define HAL_SLEEP() halNativeSleep()
+extern HAL_THREAD_LOCAL jmp_buf halNativeSleepJump;
+void halNativeSleep(void);
+
+// profiler clock (PROFILER): advanced with the game time by the host, which runs halNativeProfilerIsr() on every
+// overflow of the 8-bit count
+extern HAL_THREAD_LOCAL uint8_t halNativeProfilerCount;
+#define HAL_PROFILER_START() (halNativeProfilerCount = 0)
+#define HAL_PROFILER_COUNT() (halNativeProfilerCount)
+#define HAL_PROFILER_OVERFLOWED() (0)
+#define HAL_PROFILER_VECTOR halNativeProfilerIsr
+void halNativeProfilerIsr(void);
+
+// interrupts are called by the host, never asynchronously
+#define HAL_ISR(vector) void vector(void)
+#define HAL_DISABLE_INTERRUPTS() ((void)0)
+#define HAL_ENABLE_INTERRUPTS() ((void)0)
+
+// there are no cycles to count on the host (see bench/)
+#define HAL_BENCH_MARK(marker)
+
+// game over longjmps to halNativeHaltJump, which the host program sets (see tetris_native.c)
+extern HAL_THREAD_LOCAL jmp_buf halNativeHaltJump;
+void halNativeHalt(void);
+void halNativeAssertFailed(const char *file, int line);
+#define HAL_HALT() halNativeHalt()
+#define HAL_ASSERT_FAILED(file, line) halNativeAssertFailed(file, line)
+
+#endif /* HAL_NATIVE_H_ */
@@ -0,0 +1,148 @@
+/*
+ * lcd_capture.c
+ *
+ * Plays one game with seeded random buttons, feeds the LCD byte stream to the PCD8544
+ * emulator and prints the statistics of every game loop pass:
+ *
+ *   step dataBytes commands pixelsChanged imageCrc
+ *
+ * The buttons depend on the seed only, so two builds with different render options play the
+ * same game and their CRC columns must be identical. A summary is printed to stderr.
+ *
+ *   ./lcd_capture [-s seed] [-n steps] [-p directory]
+ *
+ * -p writes a PBM snapshot of every frame which changed the display to directory/NNNNNN.pbm.
+ * INPUT_LATENCY builds add p50 and p99 of the input latency of every button to the summary. IDLE_SLEEP builds
+ * check that idle() never waits for a tick before the next run of a frame in flight, and exit with 1 if it does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tetris_native.h"
+#include "pcd8544_emu.h"
+
+static Pcd8544 lcd;
+
+static void lcdSink(uint8_t data, uint8_t isData)
+{
+	pcdWrite(&lcd, data, isData);
+}
+
+static int writeSnapshot(const char *directory, unsigned long step)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/%06lu.pbm", directory, step);
+	FILE *file = fopen(path, "wb");
+	if (!file)
+	{
+		perror(path);
+		return -1;
+	}
+	int result = pcdWritePbm(&lcd, file);
+	fclose(file);
+	return result;
+}
+
+// formats the upper edge of latency bin "bin" in ms, the last bin has none
+static const char *latencyBin(const TetrisLatency *latency, uint8_t bin, char *text, size_t size)
+{
+	if (bin + 1 >= latency->binCount)
+	{
+		snprintf(text, size, ">%.1fms", (bin * latency->binMicroseconds) / 1000.0);
+	}
+	else
+	{
+		snprintf(text, size, "<%.1fms", ((bin + 1) * latency->binMicroseconds) / 1000.0);
+	}
+	return text;
+}
+
+// prints p50 and p99 of the input latency of every button (INPUT_LATENCY builds only)
+static void printLatency(FILE *file)
+{
+	static const uint8_t buttons[] = { TETRIS_BUTTON_LEFT, TETRIS_BUTTON_DOWN, TETRIS_BUTTON_RIGHT, TETRIS_BUTTON_ROTATION };
+	static const char *names[] = { "left", "down", "right", "rotation" };
+
+	for (int i = 0; i < 4; ++i)
+	{
+		TetrisLatency latency;
+		char p50[32], p99[32];
+		tetrisGetLatency(buttons[i], &latency);
+		if (!latency.binCount)
+		{
+			return;
+		}
+		if (!latency.presses)
+		{
+			fprintf(file, "latency %-8s no presses, %u missed\n", names[i], latency.missed);
+			continue;
+		}
+		fprintf(file, "latency %-8s %u presses, %u missed, p50 %s, p99 %s\n", names[i], latency.presses, latency.missed,
+				latencyBin(&latency, latency.p50Bin, p50, sizeof(p50)), latencyBin(&latency, latency.p99Bin, p99, sizeof(p99)));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int seed = 1;
+	unsigned long steps = 10000;
+	const char *directory = NULL;
+	int option;
+
+	while ((option = getopt(argc, argv, "s:n:p:")) != -1)
+	{
+		switch (option)
+		{
+			case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'n': steps = strtoul(optarg, NULL, 0); break;
+			case 'p': directory = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-s seed] [-n steps] [-p directory]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	srand(seed);
+	pcdReset(&lcd);
+	tetrisSetLcdSink(lcdSink);
+	tetrisInit((uint16_t)seed);
+
+	unsigned long step;
+	int running = 1;
+	PcdStats stats;
+	for (step = 0; running && step < steps; ++step)
+	{
+		uint8_t buttons = 0;
+		if (rand() % 4 == 0)
+		{
+			static const uint8_t choice[] = { TETRIS_BUTTON_LEFT, TETRIS_BUTTON_RIGHT, TETRIS_BUTTON_ROTATION, TETRIS_BUTTON_DOWN };
+			buttons = choice[rand() % 4];
+		}
+		tetrisSetButtons(buttons);
+		tetrisAdvanceTimer(400); // about 50ms of game time per step
+		tetrisTick();
+		running = tetrisStep();
+
+		pcdEndFrame(&lcd, &stats);
+		printf("%lu %u %u %u %08x\n", step, stats.dataBytes, stats.commands, stats.pixelsChanged, pcdImageCrc(&lcd));
+		if (directory && stats.pixelsChanged && writeSnapshot(directory, step))
+		{
+			return 1;
+		}
+	}
+
+	fprintf(stderr, "%lu steps%s: %u data bytes, %u commands, %u pixels changed, %u invalid bytes\n",
+			step, running ? "" : " (game over)", lcd.total.dataBytes, lcd.total.commands,
+			lcd.total.pixelsChanged, lcd.invalidBytes);
+	printLatency(stderr);
+#ifdef IDLE_SLEEP
+	unsigned long ticksInFlight = tetrisIdleTicksInFlight();
+	if (ticksInFlight)
+	{
+		fprintf(stderr, "idle() waited for a tick with a frame in flight %lu times\n", ticksInFlight);
+		return 1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * linecheck.c
+ *
+ * Check of the lock and line clear of moveTetrominoDown() against the row-by-row clear of the
+ * original code, on random boards:
+ *
+ *   lock   a tetromino is set on its landing position, the rows it covers are often completed by
+ *          the board around it (0 to 3 full lines, not always adjacent), and moveTetrominoDown()
+ *          must leave the board and the score that storing the blocks and removing one full row at
+ *          a time, moving all the rows above it down, gives
+ *   check  canPlaceTetromino() in "check" mode against a block by block test of tetrominos[], so
+ *          the tables of COLLISION_TABLES builds are checked against the bitwise path as well
+ *
+ * Build it with the options under test, e.g. -DFAST_LINE_CLEAR or -DCOLLISION_TABLES. The first
+ * mismatches are printed with their board; exits with 1 on a mismatch.
+ *
+ *   ./linecheck [-n boards] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tetris_native.h"
+
+#define MAX_REPORTS 5
+
+static unsigned long boardCount = 1000000;
+static uint32_t seed = 1;
+static unsigned long mismatches;
+static unsigned long locksWithLines[4];
+static unsigned long checks;
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// ---- reference ----
+
+// the blocks of "tetromino" in "position" row by row, as in matrix; 0 when one of them is off the board
+static int tetrominoRows(uint8_t tetromino, int position, uint8_t rows[3])
+{
+	uint8_t spec = tetrisTetrominoSpec(tetromino);
+	memset(rows, 0, 3);
+	for (int cell = 0; cell < 8; ++cell)
+	{
+		if (spec & (0x80 >> cell))
+		{
+			int x = (position & 0x07) + cell % 3;
+			int y = (position >> 3) + cell / 3;
+			if ((x > 7) || (y > 15))
+			{
+				return 0;
+			}
+			rows[cell / 3] |= 0x80 >> x;
+		}
+	}
+	return 1;
+}
+
+static int fits(const uint8_t matrix[16], uint8_t tetromino, int position)
+{
+	uint8_t rows[3];
+	if (!tetrominoRows(tetromino, position, rows))
+	{
+		return 0;
+	}
+	for (int row = 0; row < 3; ++row)
+	{
+		if (rows[row] & matrix[((position >> 3) + row) & 0x0F])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// the line clear of moveTetrominoDown() without FAST_LINE_CLEAR: every full row moves all the rows above it
+static int clearRowByRow(uint8_t matrix[16])
+{
+	int lines = 0;
+	for (int row = 15; row >= 0; --row)
+	{
+		while (matrix[row] == 0xFF)
+		{
+			++lines;
+			for (int rowUp = row; rowUp > 0; --rowUp)
+			{
+				matrix[rowUp] = matrix[rowUp - 1];
+			}
+			matrix[0] = 0;
+		}
+	}
+	return lines;
+}
+
+// ---- cases ----
+
+static void randomBoard(uint32_t *random, uint8_t matrix[16])
+{
+	int height = xorshift32(random) % 17;
+	memset(matrix, 0, 16);
+	for (int row = 16 - height; row < 16; ++row)
+	{
+		uint8_t line = (uint8_t)(xorshift32(random) | xorshift32(random));
+		if (line == 0xFF) // a board never holds a full row
+		{
+			line &= ~(0x80 >> (xorshift32(random) % 8));
+		}
+		matrix[row] = line;
+	}
+}
+
+static void printBoard(const char *title, const uint8_t matrix[16])
+{
+	printf("  %s:", title);
+	for (int row = 0; row < 16; ++row)
+	{
+		printf(" %02x", matrix[row]);
+	}
+	printf("\n");
+}
+
+static void mismatch(const char *kind, uint8_t tetromino, int position, const uint8_t board[16])
+{
+	if (++mismatches <= MAX_REPORTS)
+	{
+		printf("%s mismatch: tetromino %u at position %d\n", kind, tetromino, position);
+		printBoard("board", board);
+	}
+}
+
+static void checkLock(uint32_t *random, const uint8_t board[16])
+{
+	uint8_t tetromino = xorshift32(random) % 32;
+	int position = xorshift32(random) % 8;
+	if (!fits(board, tetromino, position))
+	{
+		return;
+	}
+	while (fits(board, tetromino, position + 8))
+	{
+		position += 8;
+	}
+
+	TetrisState state;
+	uint8_t rows[3];
+	tetrominoRows(tetromino, position, rows);
+	memcpy(state.matrix, board, 16);
+	for (int row = 0; row < 3; ++row)
+	{
+		int y = (position >> 3) + row;
+		if ((y < 16) && rows[row] && (xorshift32(random) & 1)) // the tetromino completes this row
+		{
+			state.matrix[y] = ~rows[row];
+		}
+	}
+	state.current = tetromino;
+	state.position = position;
+	state.next = (xorshift32(random) % 8) * 4; // a new tetromino comes in its first orientation
+	state.score = 0;
+
+	uint8_t expected[16];
+	memcpy(expected, state.matrix, 16);
+	for (int row = 0; row < 3; ++row)
+	{
+		expected[((position >> 3) + row) & 0x0F] |= rows[row];
+	}
+	int lines = clearRowByRow(expected);
+
+	uint8_t before[16];
+	memcpy(before, state.matrix, 16);
+	tetrisSetState(&state);
+	tetrisMoveDown(); // game over or not, the board is stored and cleared first
+	tetrisGetState(&state);
+	if (memcmp(state.matrix, expected, 16) || (state.score != lines))
+	{
+		mismatch("lock", tetromino, position, before);
+		if (mismatches <= MAX_REPORTS)
+		{
+			printBoard("expected", expected);
+			printBoard("got", state.matrix);
+			printf("  lines: expected %d, got %u\n", lines, state.score);
+		}
+	}
+	++locksWithLines[lines];
+}
+
+static void checkPlace(uint32_t *random, const uint8_t board[16])
+{
+	TetrisState state;
+	memset(&state, 0, sizeof(state));
+	memcpy(state.matrix, board, 16);
+	tetrisSetState(&state);
+	for (int i = 0; i < 8; ++i)
+	{
+		uint8_t tetromino = xorshift32(random) % 32;
+		int position = xorshift32(random) % 128;
+		if (!tetrisCanPlace(tetromino, position, TETRIS_CHECK) != !fits(board, tetromino, position))
+		{
+			mismatch("check", tetromino, position, board);
+		}
+		++checks;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while ((option = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': boardCount = strtoul(optarg, NULL, 0); break;
+			case 's': seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+			default:
+				fprintf(stderr, "usage: %s [-n boards] [-s seed]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	uint32_t random = seed ? seed : 1;
+	tetrisInit(1);
+	for (unsigned long i = 0; i < boardCount; ++i)
+	{
+		uint8_t board[16];
+		randomBoard(&random, board);
+		checkLock(&random, board);
+		checkPlace(&random, board);
+	}
+
+	printf("%lu locks (0 to 3 lines: %lu %lu %lu %lu), %lu checks: %s\n",
+			locksWithLines[0] + locksWithLines[1] + locksWithLines[2] + locksWithLines[3],
+			locksWithLines[0], locksWithLines[1], locksWithLines[2], locksWithLines[3], checks,
+			mismatches ? "MISMATCH" : "no mismatch");
+	return mismatches ? 1 : 0;
+}
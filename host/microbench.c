@@ -0,0 +1,389 @@
+/*
+ * microbench.c
+ *
+ * Microbenchmarks of the render and game logic kernels of libtetris.a on fixed boards made from
+ * the seed: empty, half full (8 rows of blocks) and nearly full (12 rows). Every row has holes,
+ * so it is never full. The kernels are:
+ *
+ *   lcd_bar/playfield        LcdBar() clearing the playfield, as displayScene() does with STATIC_BACKGROUND
+ *   lcd_bar/tile             LcdBar() drawing 4x4 squares all over the playfield
+ *   draw_tile                drawTile() all over the playfield
+ *   can_place_check/<board>  canPlaceTetromino() in "check" mode, every tetromino on every position
+ *   can_place_store/<board>  the same in "store" mode, on the positions where the tetromino fits
+ *   can_place_draw/<board>   the same in "draw" mode
+ *   display_scene/<board>    displayScene() with the LCD update, the falling T moving left and right
+ *   lock_<n>_lines/<board>   moveTetrominoDown() storing a vertical I into a well and removing n full lines
+ *
+ * A lock changes the state, so it is restored before each one. The cost of the restore is
+ * measured on its own and subtracted. The LCD kernels are skipped in LCD_NO_FRAMEBUFFER builds.
+ *
+ * Every kernel runs a batch of operations sized to take about "-t" milliseconds, "-r" times.
+ * The mean, the minimum and the standard deviation of the time per operation across the
+ * batches are reported, with the operations per second at the mean. -f json prints the same
+ * with the build options, for the comparison of two commits; -k runs the kernels whose name
+ * contains the given text only.
+ *
+ *   ./microbench [-r repetitions] [-t milliseconds] [-s seed] [-f text|json] [-k kernel]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "tetris_native.h"
+
+#ifndef MICROBENCH_OPTIONS
+#define MICROBENCH_OPTIONS ""
+#endif
+
+#define BOARDS 3
+#define MAX_PLACEMENTS (32*128)
+#define MAX_REPETITIONS 1000
+
+typedef struct
+{
+	const char *name;
+	int filledRows;
+	TetrisState state;
+	uint16_t placements[MAX_PLACEMENTS]; // tetromino << 8 | position, where the tetromino fits
+	int placementCount;
+	TetrisState locks[4]; // the I above a well and 0-3 full rows under it
+} Board;
+
+typedef struct
+{
+	char name[48];
+	uint64_t ops; // per batch
+	int repetitions;
+	double mean; // ns per operation
+	double min;
+	double stddev;
+} Result;
+
+typedef void (*Kernel)(const Board *board, uint64_t ops);
+
+static Board boards[BOARDS] = { { .name = "empty", .filledRows = 0 }, { .name = "half", .filledRows = 8 }, { .name = "full", .filledRows = 12 } };
+static int repetitions = 10;
+static double batchTime = 0.02; // seconds
+static uint32_t seed = 1;
+static int json;
+static const char *filter;
+static Result results[64];
+static int resultCount;
+static volatile int sink; // keeps the results of the measured calls alive
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static double now(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static void makeBoard(Board *board, uint32_t *random)
+{
+	tetrisGetState(&board->state);
+	memset(board->state.matrix, 0, sizeof(board->state.matrix));
+	for (int row = 16 - board->filledRows; row < 16; ++row)
+	{
+		uint8_t line = (uint8_t)(xorshift32(random) | xorshift32(random)); // 3 blocks of 4
+		if (line == 0xFF)
+		{
+			line &= ~(0x80 >> (xorshift32(random) & 0x07));
+		}
+		board->state.matrix[row] = line;
+	}
+	board->state.current = 5*4; // T
+	board->state.position = 3 + 8*2;
+	board->state.score = 0;
+
+	tetrisSetState(&board->state);
+	board->placementCount = 0;
+	for (int tetromino = 0; tetromino < 32; ++tetromino)
+	{
+		for (int position = 0; position < 128; ++position)
+		{
+			if (tetrisCanPlace(tetromino, position, TETRIS_CHECK))
+			{
+				board->placements[board->placementCount++] = (uint16_t)(tetromino << 8 | position);
+			}
+		}
+	}
+
+	for (int lines = 0; lines < 4; ++lines)
+	{
+		TetrisState *lock = &board->locks[lines];
+		uint8_t x = xorshift32(random) & 0x07;
+		uint8_t well = 0x80 >> x;
+		*lock = board->state;
+		for (int row = 13; row < 16; ++row)
+		{
+			lock->matrix[row] = (row >= 16 - lines) ? (uint8_t)~well : (lock->matrix[row] & ~well);
+		}
+		lock->current = 0*4 + 1; // vertical I
+		lock->position = x + 8*13;
+	}
+}
+
+static void lcdBarPlayfield(const Board *board, uint64_t ops)
+{
+	(void)board;
+	while (ops--)
+	{
+		tetrisLcdBar(0, 7, 64, 34);
+	}
+}
+
+static void lcdBarTile(const Board *board, uint64_t ops)
+{
+	(void)board;
+	for (uint64_t op = 0; op < ops; ++op)
+	{
+		tetrisLcdBar((op >> 3 & 0x0F) * 4, 36 - (op & 0x07) * 4, 4, 4);
+	}
+}
+
+static void drawTiles(const Board *board, uint64_t ops)
+{
+	(void)board;
+	for (uint64_t op = 0; op < ops; ++op)
+	{
+		tetrisDrawTile(op & 0x07, op >> 3 & 0x0F);
+	}
+}
+
+static void canPlaceCheck(const Board *board, uint64_t ops)
+{
+	int fits = 0;
+	tetrisSetState(&board->state);
+	for (uint64_t op = 0; op < ops; ++op)
+	{
+		fits += tetrisCanPlace(op >> 7 & 0x1F, op & 0x7F, TETRIS_CHECK);
+	}
+	sink = fits;
+}
+
+static void canPlaceMode(const Board *board, uint64_t ops, uint8_t mode)
+{
+	int i = 0;
+	tetrisSetState(&board->state);
+	while (ops--)
+	{
+		uint16_t placement = board->placements[i];
+		tetrisCanPlace(placement >> 8, placement & 0xFF, mode);
+		if (++i == board->placementCount)
+		{
+			i = 0;
+			tetrisSetState(&board->state); // the stored blocks would pile up
+		}
+	}
+}
+
+static void canPlaceStore(const Board *board, uint64_t ops)
+{
+	canPlaceMode(board, ops, TETRIS_STORE);
+}
+
+static void canPlaceDraw(const Board *board, uint64_t ops)
+{
+	canPlaceMode(board, ops, TETRIS_DRAW);
+}
+
+static void displayScenes(const Board *board, uint64_t ops)
+{
+	tetrisSetState(&board->state);
+	for (uint64_t op = 0; op < ops; ++op)
+	{
+		tetrisSetCurrent(board->state.current, board->state.position - (op & 1));
+		tetrisDisplayScene();
+	}
+}
+
+static const Board *lockBoard;
+static int lockLines;
+
+static void restoreLock(const Board *board, uint64_t ops)
+{
+	(void)board;
+	while (ops--)
+	{
+		tetrisSetState(&lockBoard->locks[lockLines]);
+	}
+}
+
+static void lockTetromino(const Board *board, uint64_t ops)
+{
+	(void)board;
+	int over = 0;
+	while (ops--)
+	{
+		tetrisSetState(&lockBoard->locks[lockLines]);
+		over += !tetrisMoveDown();
+	}
+	sink = over;
+}
+
+// returns the nanoseconds per operation of every batch in "samples"
+static uint64_t measure(Kernel kernel, const Board *board, double samples[])
+{
+	uint64_t ops = 1;
+	while (1) // the batch size taking at least batchTime
+	{
+		double start = now();
+		kernel(board, ops);
+		double elapsed = now() - start;
+		if (elapsed >= batchTime)
+		{
+			break;
+		}
+		ops = (elapsed * 4 < batchTime) ? ops * 4 : (uint64_t)(ops * batchTime / elapsed * 1.1) + 1;
+	}
+	for (int i = 0; i < repetitions; ++i)
+	{
+		double start = now();
+		kernel(board, ops);
+		samples[i] = (now() - start) * 1e9 / ops;
+	}
+	return ops;
+}
+
+static void run(const char *name, Kernel kernel, const Board *board, double overhead)
+{
+	double samples[MAX_REPETITIONS];
+	Result *result = &results[resultCount];
+
+	if (board)
+	{
+		snprintf(result->name, sizeof(result->name), "%s/%s", name, board->name);
+	}
+	else
+	{
+		snprintf(result->name, sizeof(result->name), "%s", name);
+	}
+	if (filter && !strstr(result->name, filter))
+	{
+		return;
+	}
+	result->ops = measure(kernel, board, samples);
+	result->repetitions = repetitions;
+	result->mean = 0;
+	result->min = samples[0];
+	for (int i = 0; i < repetitions; ++i)
+	{
+		samples[i] -= overhead;
+		result->mean += samples[i];
+		if (samples[i] < result->min)
+		{
+			result->min = samples[i];
+		}
+	}
+	result->mean /= repetitions;
+	double variance = 0;
+	for (int i = 0; i < repetitions; ++i)
+	{
+		variance += (samples[i] - result->mean) * (samples[i] - result->mean);
+	}
+	result->stddev = (repetitions > 1) ? sqrt(variance / (repetitions - 1)) : 0;
+	++resultCount;
+}
+
+static void print(void)
+{
+	if (json)
+	{
+		printf("{\n  \"options\": \"%s\",\n  \"seed\": %u,\n  \"repetitions\": %d,\n  \"results\": [\n",
+				MICROBENCH_OPTIONS, seed, repetitions);
+		for (int i = 0; i < resultCount; ++i)
+		{
+			const Result *r = &results[i];
+			printf("    { \"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, "
+					"\"ns_per_op_stddev\": %.2f, \"ops_per_s\": %.0f }%s\n",
+					r->name, (unsigned long long)r->ops, r->mean, r->min, r->stddev, 1e9 / r->mean,
+					(i + 1 < resultCount) ? "," : "");
+		}
+		printf("  ]\n}\n");
+		return;
+	}
+	printf("%-28s %10s %10s %10s %14s\n", "kernel", "ns/op", "min", "stddev", "ops/s");
+	for (int i = 0; i < resultCount; ++i)
+	{
+		const Result *r = &results[i];
+		printf("%-28s %10.2f %10.2f %10.2f %14.0f\n", r->name, r->mean, r->min, r->stddev, 1e9 / r->mean);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int option;
+	while ((option = getopt(argc, argv, "r:t:s:f:k:")) != -1)
+	{
+		switch (option)
+		{
+			case 'r': repetitions = atoi(optarg); break;
+			case 't': batchTime = atof(optarg) / 1000; break;
+			case 's': seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'f': json = !strcmp(optarg, "json"); break;
+			case 'k': filter = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-r repetitions] [-t milliseconds] [-s seed] [-f text|json] [-k kernel]\n", argv[0]);
+				return 2;
+		}
+	}
+	if ((repetitions < 1) || (repetitions > MAX_REPETITIONS) || (batchTime <= 0))
+	{
+		fprintf(stderr, "-r must be 1-%d and -t positive\n", MAX_REPETITIONS);
+		return 2;
+	}
+
+	uint32_t random = seed ? seed : 1;
+	tetrisInit((uint16_t)seed);
+	for (int b = 0; b < BOARDS; ++b)
+	{
+		makeBoard(&boards[b], &random);
+	}
+
+	int lcd = tetrisLcdCache() != NULL;
+	if (lcd)
+	{
+		run("lcd_bar/playfield", lcdBarPlayfield, NULL, 0);
+		run("lcd_bar/tile", lcdBarTile, NULL, 0);
+		run("draw_tile", drawTiles, NULL, 0);
+	}
+	for (int b = 0; b < BOARDS; ++b)
+	{
+		const Board *board = &boards[b];
+		run("can_place_check", canPlaceCheck, board, 0);
+		run("can_place_store", canPlaceStore, board, 0);
+		if (lcd)
+		{
+			run("can_place_draw", canPlaceDraw, board, 0);
+		}
+		run("display_scene", displayScenes, board, 0);
+		lockBoard = board;
+		for (lockLines = 0; lockLines < 4; ++lockLines)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "lock_%d_lines", lockLines);
+			double samples[MAX_REPETITIONS];
+			measure(restoreLock, board, samples);
+			double overhead = samples[0];
+			for (int i = 1; i < repetitions; ++i)
+			{
+				overhead = (samples[i] < overhead) ? samples[i] : overhead;
+			}
+			run(name, lockTetromino, board, overhead);
+		}
+	}
+	print();
+	return 0;
+}
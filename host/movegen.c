@@ -0,0 +1,109 @@
+/*
+ * movegen.c
+ *
+ * Breadth-first search over the (orientation, position) states of one tetromino. The visited
+ * states are kept in an open addressing hash set whose slots are tagged with the number of the
+ * search, so starting a search does not clear it.
+ */
+
+#include "movegen.h"
+#include "tetris_native.h"
+
+#define VISITED_SLOTS 1024 // power of two, twice the states of one tetromino
+#define VISITED_MASK (VISITED_SLOTS - 1)
+
+typedef struct
+{
+	uint32_t search[VISITED_SLOTS]; // search which filled the slot
+	uint16_t key[VISITED_SLOTS];
+	uint32_t current; // number of the current search, never 0
+} VisitedSet;
+
+static __thread VisitedSet visited;
+
+// adds "key" to the visited set; returns 0 when it was there already
+static int visit(uint16_t key)
+{
+	uint32_t slot = ((uint32_t)key * 2654435761u) >> 22; // 10 bits of Fibonacci hashing
+	while (visited.search[slot] == visited.current)
+	{
+		if (visited.key[slot] == key)
+		{
+			return 0;
+		}
+		slot = (slot + 1) & VISITED_MASK;
+	}
+	visited.search[slot] = visited.current;
+	visited.key[slot] = key;
+	return 1;
+}
+
+static void newSearch(void)
+{
+	if (!++visited.current) // the tags wrapped, forget them all
+	{
+		for (int slot = 0; slot < VISITED_SLOTS; ++slot)
+		{
+			visited.search[slot] = 0;
+		}
+		visited.current = 1;
+	}
+}
+
+// queues the state of a move unless it has been visited or canPlaceTetromino() rejects it
+static void tryMove(uint8_t tetromino, uint8_t position, uint16_t *queue, int *tail)
+{
+	uint16_t key = (uint16_t)(tetromino << 8 | position);
+	if (visit(key) && tetrisCanPlace(tetromino, position, TETRIS_CHECK)) // the hash lookup is cheaper than the check
+	{
+		queue[(*tail)++] = key;
+	}
+}
+
+int movegenPlacements(MovegenPlacement placements[MOVEGEN_MAX_PLACEMENTS], uint32_t *nodes)
+{
+	uint16_t queue[MOVEGEN_MAX_PLACEMENTS]; // states as tetromino << 8 | position
+	int head = 0;
+	int tail = 0;
+	int count = 0;
+	TetrisState state;
+
+	tetrisGetState(&state);
+	newSearch();
+	visit((uint16_t)(state.current << 8 | state.position));
+	queue[tail++] = (uint16_t)(state.current << 8 | state.position);
+	while (head < tail)
+	{
+		uint8_t tetromino = queue[head] >> 8;
+		uint8_t position = queue[head] & 0xFF;
+		++head;
+
+		uint8_t down = position + 8;
+		if (tetrisCanPlace(tetromino, down, TETRIS_CHECK))
+		{
+			if (visit((uint16_t)(tetromino << 8 | down)))
+			{
+				queue[tail++] = (uint16_t)(tetromino << 8 | down);
+			}
+		}
+		else // resting: moveTetrominoDown() would store it here
+		{
+			placements[count].tetromino = tetromino;
+			placements[count++].position = position;
+		}
+		if ((position & 0x07) != 0)
+		{
+			tryMove(tetromino, position - 1, queue, &tail);
+		}
+		if (((position + 1) & 0x07) != 0)
+		{
+			tryMove(tetromino, position + 1, queue, &tail);
+		}
+		tryMove(((tetromino & 0x03) == 0) ? (tetromino | 0x03) : (tetromino - 1), position, queue, &tail);
+	}
+	if (nodes)
+	{
+		*nodes = head;
+	}
+	return count;
+}
@@ -0,0 +1,28 @@
+/*
+ * movegen.h
+ *
+ * Move generator of the native build: enumerates every resting position the current tetromino
+ * can reach from where it is with the moves of gameStep(): one row down, one column left or
+ * right, and the rotation (orientation 0 becomes 3, the others decrease by one), each taken only
+ * when canPlaceTetromino() accepts the new state. A state is resting when it cannot move down,
+ * which is where moveTetrominoDown() stores the tetromino.
+ */
+
+#ifndef MOVEGEN_H_
+#define MOVEGEN_H_
+
+#include <stdint.h>
+
+#define MOVEGEN_MAX_PLACEMENTS 512 // 4 orientations x 128 positions
+
+typedef struct
+{
+	uint8_t tetromino; // shape*4 + orientation
+	uint8_t position; // x + 8*y
+} MovegenPlacement;
+
+// Enumerates the resting positions reachable by the current tetromino of the game (see tetrisGetState())
+// in breadth-first order. Returns their number; "nodes", when not NULL, receives the number of states visited.
+int movegenPlacements(MovegenPlacement placements[MOVEGEN_MAX_PLACEMENTS], uint32_t *nodes);
+
+#endif /* MOVEGEN_H_ */
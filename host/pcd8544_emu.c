@@ -0,0 +1,205 @@
+/*
+ * pcd8544_emu.c
+ *
+ * Emulator of the PCD8544 controller, see pcd8544_emu.h.
+ */
+
+#include <string.h>
+#include "pcd8544_emu.h"
+
+void pcdReset(Pcd8544 *lcd)
+{
+	memset(lcd, 0, sizeof(*lcd));
+	lcd->powerDown = 1;
+	lcd->displayMode = PCD_BLANK;
+}
+
+static void pcdCommand(Pcd8544 *lcd, uint8_t byte)
+{
+	++lcd->frame.commands;
+
+	if ((byte & 0xF8) == 0x20) // function set, available in both instruction sets
+	{
+		lcd->powerDown = (byte >> 2) & 1;
+		lcd->vertical = (byte >> 1) & 1;
+		lcd->extended = byte & 1;
+	}
+	else if (byte == 0x00) // NOP
+	{
+	}
+	else if (!lcd->extended)
+	{
+		if (byte & 0x80) // set X address
+		{
+			uint8_t x = byte & 0x7F;
+			if (x < PCD_X_RES)
+			{
+				lcd->x = x;
+			}
+			else
+			{
+				++lcd->invalidBytes;
+			}
+		}
+		else if ((byte & 0xF8) == 0x40) // set Y address
+		{
+			uint8_t y = byte & 0x07;
+			if (y < PCD_BANKS)
+			{
+				lcd->y = y;
+			}
+			else
+			{
+				++lcd->invalidBytes;
+			}
+		}
+		else if ((byte & 0xFA) == 0x08) // display control
+		{
+			lcd->displayMode = (PcdDisplayMode)((byte & 0x01) | ((byte >> 1) & 0x02));
+		}
+		else
+		{
+			++lcd->invalidBytes;
+		}
+	}
+	else
+	{
+		if (byte & 0x80) // set Vop
+		{
+			lcd->vop = byte & 0x7F;
+		}
+		else if ((byte & 0xF8) == 0x10) // bias system
+		{
+			lcd->bias = byte & 0x07;
+		}
+		else if ((byte & 0xFC) == 0x04) // temperature coefficient
+		{
+			lcd->tempCoefficient = byte & 0x03;
+		}
+		else
+		{
+			++lcd->invalidBytes;
+		}
+	}
+}
+
+void pcdWrite(Pcd8544 *lcd, uint8_t byte, uint8_t isData)
+{
+	if (!isData)
+	{
+		pcdCommand(lcd, byte);
+		return;
+	}
+
+	++lcd->frame.dataBytes;
+	lcd->ram[lcd->y][lcd->x] = byte;
+	if (lcd->vertical)
+	{
+		if (++lcd->y == PCD_BANKS)
+		{
+			lcd->y = 0;
+			if (++lcd->x == PCD_X_RES)
+			{
+				lcd->x = 0;
+			}
+		}
+	}
+	else
+	{
+		if (++lcd->x == PCD_X_RES)
+		{
+			lcd->x = 0;
+			if (++lcd->y == PCD_BANKS)
+			{
+				lcd->y = 0;
+			}
+		}
+	}
+}
+
+void pcdImage(const Pcd8544 *lcd, uint8_t image[PCD_BANKS][PCD_X_RES])
+{
+	PcdDisplayMode mode = lcd->powerDown ? PCD_BLANK : lcd->displayMode;
+
+	for (int bank = 0; bank < PCD_BANKS; ++bank)
+	{
+		for (int x = 0; x < PCD_X_RES; ++x)
+		{
+			uint8_t byte = lcd->ram[bank][x];
+			switch (mode)
+			{
+				case PCD_BLANK:   byte = 0x00; break;
+				case PCD_ALL_ON:  byte = 0xFF; break;
+				case PCD_NORMAL:  break;
+				case PCD_INVERSE: byte = ~byte; break;
+			}
+			image[bank][x] = byte;
+		}
+	}
+}
+
+void pcdEndFrame(Pcd8544 *lcd, PcdStats *stats)
+{
+	uint8_t image[PCD_BANKS][PCD_X_RES];
+
+	pcdImage(lcd, image);
+	for (int bank = 0; bank < PCD_BANKS; ++bank)
+	{
+		for (int x = 0; x < PCD_X_RES; ++x)
+		{
+			lcd->frame.pixelsChanged += __builtin_popcount(image[bank][x] ^ lcd->shownImage[bank][x]);
+		}
+	}
+	memcpy(lcd->shownImage, image, sizeof(image));
+
+	lcd->total.dataBytes += lcd->frame.dataBytes;
+	lcd->total.commands += lcd->frame.commands;
+	lcd->total.pixelsChanged += lcd->frame.pixelsChanged;
+	if (stats)
+	{
+		*stats = lcd->frame;
+	}
+	memset(&lcd->frame, 0, sizeof(lcd->frame));
+}
+
+uint32_t pcdImageCrc(const Pcd8544 *lcd)
+{
+	uint8_t image[PCD_BANKS][PCD_X_RES];
+	const uint8_t *p = &image[0][0];
+	uint32_t crc = 0xFFFFFFFF;
+
+	pcdImage(lcd, image);
+	for (size_t i = 0; i < sizeof(image); ++i)
+	{
+		crc ^= p[i];
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+int pcdWritePbm(const Pcd8544 *lcd, FILE *file)
+{
+	uint8_t image[PCD_BANKS][PCD_X_RES];
+
+	pcdImage(lcd, image);
+	fprintf(file, "P4\n%d %d\n", PCD_X_RES, PCD_Y_RES);
+	for (int y = 0; y < PCD_Y_RES; ++y)
+	{
+		uint8_t row[(PCD_X_RES + 7) / 8] = { 0 };
+		for (int x = 0; x < PCD_X_RES; ++x)
+		{
+			if (image[y >> 3][x] & (1 << (y & 7)))
+			{
+				row[x >> 3] |= 0x80 >> (x & 7); // 1 is black in PBM
+			}
+		}
+		if (fwrite(row, sizeof(row), 1, file) != 1)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * pcd8544_emu.h
+ *
+ * Emulator of the PCD8544 controller of the Nokia 3310 display. It consumes the SPI byte
+ * stream together with the D/C pin (see tetrisSetLcdSink()), executes the basic and the
+ * extended instruction set, keeps the 6 banks x 84 columns display RAM with horizontal and
+ * vertical addressing, and counts the traffic of every frame.
+ */
+
+#ifndef PCD8544_EMU_H_
+#define PCD8544_EMU_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PCD_X_RES 84
+#define PCD_Y_RES 48
+#define PCD_BANKS (PCD_Y_RES / 8)
+
+// display control modes (D and E bits of the display control instruction)
+typedef enum
+{
+	PCD_BLANK = 0,
+	PCD_ALL_ON = 1,
+	PCD_NORMAL = 2,
+	PCD_INVERSE = 3
+} PcdDisplayMode;
+
+typedef struct
+{
+	uint32_t dataBytes; // bytes sent with D/C high
+	uint32_t commands; // bytes sent with D/C low
+	uint32_t pixelsChanged; // visible pixels that differ from the previous frame
+} PcdStats;
+
+typedef struct
+{
+	uint8_t ram[PCD_BANKS][PCD_X_RES]; // bit 0 of a byte is the top pixel of the bank
+	uint8_t x; // address counters
+	uint8_t y;
+	uint8_t extended; // H bit of the function set
+	uint8_t vertical; // V bit of the function set
+	uint8_t powerDown; // PD bit of the function set
+	PcdDisplayMode displayMode;
+	uint8_t vop; // settings of the extended instruction set, kept for inspection only
+	uint8_t bias;
+	uint8_t tempCoefficient;
+	uint32_t invalidBytes; // unknown instructions and addresses out of range
+	PcdStats frame; // traffic since the last pcdEndFrame()
+	PcdStats total;
+	uint8_t shownImage[PCD_BANKS][PCD_X_RES]; // visible image at the last pcdEndFrame()
+} Pcd8544;
+
+// Puts the controller in its reset state: power down, blank display, RAM cleared.
+void pcdReset(Pcd8544 *lcd);
+
+// Executes one byte of the SPI stream. isData is the state of the D/C pin.
+void pcdWrite(Pcd8544 *lcd, uint8_t byte, uint8_t isData);
+
+// Visible image in the display RAM layout: the RAM as modified by the display mode.
+void pcdImage(const Pcd8544 *lcd, uint8_t image[PCD_BANKS][PCD_X_RES]);
+
+// Closes the current frame: counts the changed pixels, adds the frame to the totals,
+// optionally returns its statistics and starts a new frame.
+void pcdEndFrame(Pcd8544 *lcd, PcdStats *stats);
+
+// CRC-32 of the visible image, handy for comparing the frames of two builds.
+uint32_t pcdImageCrc(const Pcd8544 *lcd);
+
+// Writes the visible image as a binary PBM (P4) file.
+int pcdWritePbm(const Pcd8544 *lcd, FILE *file);
+
+#endif /* PCD8544_EMU_H_ */
@@ -0,0 +1,282 @@
+/*
+ * perft.c
+ *
+ * Benchmark and check of the move generator (movegen.c), in the manner of a chess perft: from a
+ * number of boards it counts the placements reachable with a sequence of "depth" tetrominos and
+ * reports the searches and the states (nodes) visited per second.
+ *
+ *   ./perft [-d depth] [-r roots] [-s seed] [-f maxFill] [-v]
+ *
+ * Root r is a game started with seed+r in which up to maxFill random placements have been played
+ * already (r modulo maxFill+1 of them). The tetrominos of the sequence are the current one, the
+ * next one and those the game would draw after them. Every placement of the sequence is stored
+ * with moveTetrominoDown(), so the full lines are removed as in the game.
+ *
+ * -v checks every search against a brute force one: a fixed point iteration over all the states
+ * with its own collision test on tetrominos[]. Exits with 1 on a mismatch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "tetris_native.h"
+#include "movegen.h"
+
+#define MAX_DEPTH 8
+
+static int verify;
+static uint8_t sequence[MAX_DEPTH];
+static uint64_t placementsAtDepth[MAX_DEPTH];
+static uint64_t nodes;
+static uint64_t searches;
+static uint64_t mismatches;
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// reference collision test: the blocks of the 3x3 specification inside the board and on empty cells
+static int fits(const uint8_t matrix[16], uint8_t tetromino, int position)
+{
+	uint8_t spec = tetrisTetrominoSpec(tetromino);
+	for (int block = 0; block < 8; ++block)
+	{
+		if (spec & (0x80 >> block))
+		{
+			int x = (position & 0x07) + block % 3;
+			int y = (position >> 3) + block / 3;
+			if ((x >= 8) || (y >= 16) || (matrix[y] & (0x80 >> x)))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// marks the resting states reachable by the current tetromino of "state" in resting[orientation][position]
+static void bruteForce(const TetrisState *state, uint8_t resting[4][128])
+{
+	uint8_t reached[4][128];
+	uint8_t shape = state->current & ~0x03;
+	int changed = 1;
+
+	memset(reached, 0, sizeof(reached));
+	reached[state->current & 0x03][state->position] = 1;
+	while (changed)
+	{
+		changed = 0;
+		for (int orientation = 0; orientation < 4; ++orientation)
+		{
+			for (int position = 0; position < 128; ++position)
+			{
+				if (!reached[orientation][position])
+				{
+					continue;
+				}
+				int rotated = orientation ? orientation - 1 : 3;
+				int moves[4][2] =
+				{
+					{ orientation, position + 8 },
+					{ orientation, (position & 0x07) ? position - 1 : -1 },
+					{ orientation, ((position + 1) & 0x07) ? position + 1 : -1 },
+					{ rotated, position }
+				};
+				for (int move = 0; move < 4; ++move)
+				{
+					int o = moves[move][0];
+					int p = moves[move][1];
+					if ((p >= 0) && (p < 128) && !reached[o][p] && fits(state->matrix, shape | o, p))
+					{
+						reached[o][p] = 1;
+						changed = 1;
+					}
+				}
+			}
+		}
+	}
+	for (int orientation = 0; orientation < 4; ++orientation)
+	{
+		for (int position = 0; position < 128; ++position)
+		{
+			resting[orientation][position] = reached[orientation][position] && !fits(state->matrix, shape | orientation, position + 8);
+		}
+	}
+}
+
+static void check(const MovegenPlacement *placements, int count)
+{
+	TetrisState state;
+	uint8_t expected[4][128];
+	uint8_t found[4][128];
+	int expectedCount = 0;
+
+	tetrisGetState(&state);
+	bruteForce(&state, expected);
+	memset(found, 0, sizeof(found));
+	int duplicates = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		uint8_t *cell = &found[placements[i].tetromino & 0x03][placements[i].position];
+		duplicates += *cell;
+		*cell = 1;
+	}
+	for (int orientation = 0; orientation < 4; ++orientation)
+	{
+		for (int position = 0; position < 128; ++position)
+		{
+			expectedCount += expected[orientation][position];
+		}
+	}
+	if (duplicates || memcmp(found, expected, sizeof(found)))
+	{
+		if (!mismatches++)
+		{
+			fprintf(stderr, "mismatch: tetromino %u at %u, %d placements (%d duplicates), brute force %d\n",
+					state.current, state.position, count, duplicates, expectedCount);
+			for (int row = 0; row < 16; ++row)
+			{
+				for (int x = 0; x < 8; ++x)
+				{
+					fputc((state.matrix[row] & (0x80 >> x)) ? '#' : '.', stderr);
+				}
+				fputc('\n', stderr);
+			}
+		}
+	}
+}
+
+// counts the placements of the tetrominos sequence[ply...] of depth "depth"
+static uint64_t perft(int depth, int ply)
+{
+	MovegenPlacement placements[MOVEGEN_MAX_PLACEMENTS];
+	uint32_t visited;
+	int count = movegenPlacements(placements, &visited);
+
+	nodes += visited;
+	++searches;
+	placementsAtDepth[ply] += count;
+	if (verify)
+	{
+		check(placements, count);
+	}
+	if (depth == 1)
+	{
+		return count;
+	}
+
+	TetrisState state;
+	uint64_t leaves = 0;
+	tetrisGetState(&state);
+	for (int i = 0; i < count; ++i)
+	{
+		TetrisState placed = state;
+		placed.current = placements[i].tetromino;
+		placed.position = placements[i].position;
+		placed.next = sequence[ply + 1];
+		tetrisSetState(&placed);
+		if (tetrisMoveDown()) // stores it, the next tetromino of the sequence comes
+		{
+			leaves += perft(depth - 1, ply + 1);
+		}
+	}
+	tetrisSetState(&state);
+	return leaves;
+}
+
+// starts the game of root "root" and plays its random placements
+static void prepareRoot(uint16_t seed, int fill)
+{
+	uint32_t random = 0x9E3779B9u ^ seed;
+	MovegenPlacement placements[MOVEGEN_MAX_PLACEMENTS];
+
+	tetrisInit(seed);
+	for (int i = 0; i < fill; ++i)
+	{
+		int count = movegenPlacements(placements, NULL);
+		TetrisState state;
+		tetrisGetState(&state);
+		TetrisState saved = state;
+		MovegenPlacement *choice = &placements[xorshift32(&random) % count];
+		state.current = choice->tetromino;
+		state.position = choice->position;
+		tetrisSetState(&state);
+		if (!tetrisMoveDown()) // game over, keep the board before it
+		{
+			tetrisSetState(&saved);
+			break;
+		}
+	}
+
+	TetrisState state;
+	tetrisGetState(&state);
+	sequence[0] = state.current;
+	sequence[1] = state.next;
+	for (int ply = 2; ply < MAX_DEPTH; ++ply)
+	{
+		sequence[ply] = tetrisRandomTetromino();
+	}
+	tetrisSetState(&state);
+}
+
+int main(int argc, char *argv[])
+{
+	int depth = 2;
+	unsigned long roots = 1000;
+	unsigned int seed = 1;
+	int maxFill = 30;
+	int option;
+
+	while ((option = getopt(argc, argv, "d:r:s:f:v")) != -1)
+	{
+		switch (option)
+		{
+			case 'd': depth = atoi(optarg); break;
+			case 'r': roots = strtoul(optarg, NULL, 0); break;
+			case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'f': maxFill = atoi(optarg); break;
+			case 'v': verify = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-d depth] [-r roots] [-s seed] [-f maxFill] [-v]\n", argv[0]);
+				return 2;
+		}
+	}
+	if ((depth < 1) || (depth > MAX_DEPTH) || (maxFill < 0))
+	{
+		fprintf(stderr, "depth 1-%d, maxFill >= 0\n", MAX_DEPTH);
+		return 2;
+	}
+
+	double seconds = 0;
+	uint64_t leaves = 0;
+	for (unsigned long root = 0; root < roots; ++root)
+	{
+		struct timespec started, finished;
+		prepareRoot((uint16_t)(seed + root), (int)(root % (maxFill + 1)));
+		clock_gettime(CLOCK_MONOTONIC, &started);
+		leaves += perft(depth, 0);
+		clock_gettime(CLOCK_MONOTONIC, &finished);
+		seconds += (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+	}
+
+	for (int ply = 0; ply < depth; ++ply)
+	{
+		printf("depth %d: %llu placements\n", ply + 1, (unsigned long long)placementsAtDepth[ply]);
+	}
+	printf("%lu roots, %llu leaves, %llu searches, %llu nodes in %.3fs%s\n", roots, (unsigned long long)leaves,
+			(unsigned long long)searches, (unsigned long long)nodes, seconds, verify ? " (with the brute force checks)" : "");
+	printf("%.0f nodes/s, %.0f searches/s\n", nodes / seconds, searches / seconds);
+	if (verify)
+	{
+		printf("%llu searches checked against brute force, %llu mismatches\n", (unsigned long long)searches,
+				(unsigned long long)mismatches);
+	}
+	return mismatches ? 1 : 0;
+}
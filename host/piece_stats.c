@@ -0,0 +1,150 @@
+/*
+ * piece_stats.c
+ *
+ * Checks the distribution of the tetrominos drawn by randomizeNextTetromino():
+ * - every value is a shape (0-7) times 4, in orientation 0,
+ * - the chi-square statistic of the shape counts is below the 0.1% critical value for 7 degrees of freedom,
+ * - without -b: the same for the pairs of successive shapes (63 degrees of freedom),
+ * - with -b (PIECE_BAG builds): every aligned group of 8 tetrominos holds all the shapes.
+ * The ADC interrupt of ENTROPY_POOL builds runs "samples" times between the draws.
+ *
+ *   ./piece_stats [-n count] [-s seed] [-a samples] [-b]
+ *
+ * Exits with 1 when a check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tetris_native.h"
+
+#define SHAPES 8
+#define CHI2_CRITICAL_7 24.322  // p = 0.001
+#define CHI2_CRITICAL_63 103.442 // p = 0.001
+
+static double chiSquare(const unsigned long *counts, int cells, unsigned long total)
+{
+	double expected = (double)total / cells;
+	double sum = 0;
+	for (int i = 0; i < cells; ++i)
+	{
+		double d = counts[i] - expected;
+		sum += d * d / expected;
+	}
+	return sum;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long count = 800000;
+	unsigned int seed = 1;
+	unsigned int samples = 4;
+	int bag = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "n:s:a:b")) != -1)
+	{
+		switch (option)
+		{
+			case 'n': count = strtoul(optarg, NULL, 0); break;
+			case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'a': samples = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'b': bag = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-n count] [-s seed] [-a samples] [-b]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	unsigned long shapes[SHAPES] = { 0 };
+	unsigned long pairs[SHAPES * SHAPES] = { 0 };
+	unsigned long invalid = 0;
+	unsigned long badBags = 0;
+	uint8_t bagSeen = 0;
+	int previous = -1;
+
+	tetrisInit((uint16_t)seed);
+	for (unsigned long i = 0; i < count; ++i)
+	{
+		for (unsigned int j = 0; j < samples; ++j)
+		{
+			tetrisAdcSample();
+		}
+		uint8_t tetromino = tetrisRandomTetromino();
+		if ((tetromino & 0x03) || (tetromino >= SHAPES * 4))
+		{
+			++invalid;
+			continue;
+		}
+		int shape = tetromino >> 2;
+		++shapes[shape];
+		if (previous >= 0)
+		{
+			++pairs[previous * SHAPES + shape];
+		}
+		previous = shape;
+		bagSeen |= 1 << shape;
+		if ((i % SHAPES) == SHAPES - 1)
+		{
+			badBags += (bagSeen != 0xFF);
+			bagSeen = 0;
+		}
+	}
+
+	// tetrisInit() has drawn tetrominos already, so the bags may start anywhere: find the alignment
+	if (bag)
+	{
+		unsigned long best = badBags;
+		for (int offset = 1; offset < SHAPES && best; ++offset)
+		{
+			unsigned long bad = 0;
+			tetrisInit((uint16_t)seed);
+			for (int k = 0; k < offset; ++k)
+			{
+				tetrisRandomTetromino();
+			}
+			for (unsigned long i = 0; i + SHAPES <= count; i += SHAPES)
+			{
+				uint8_t seen = 0;
+				for (int k = 0; k < SHAPES; ++k)
+				{
+					for (unsigned int j = 0; j < samples; ++j)
+					{
+						tetrisAdcSample();
+					}
+					seen |= 1 << (tetrisRandomTetromino() >> 2);
+				}
+				bad += (seen != 0xFF);
+			}
+			if (bad < best)
+			{
+				best = bad;
+			}
+		}
+		badBags = best;
+	}
+
+	int failed = 0;
+	double shapeChi2 = chiSquare(shapes, SHAPES, count - invalid);
+	printf("tetrominos: %lu, invalid: %lu\n", count, invalid);
+	printf("shapes:");
+	for (int i = 0; i < SHAPES; ++i)
+	{
+		printf(" %.4f", (double)shapes[i] / (count - invalid));
+	}
+	printf("\nshape chi-square: %.2f (critical %.2f)\n", shapeChi2, CHI2_CRITICAL_7);
+	failed |= invalid || (shapeChi2 > CHI2_CRITICAL_7);
+	if (bag)
+	{
+		printf("incomplete bags: %lu\n", badBags);
+		failed |= (badBags != 0);
+	}
+	else
+	{
+		double pairChi2 = chiSquare(pairs, SHAPES * SHAPES, count - invalid - 1);
+		printf("pair chi-square: %.2f (critical %.2f)\n", pairChi2, CHI2_CRITICAL_63);
+		failed |= (pairChi2 > CHI2_CRITICAL_63);
+	}
+	printf("%s\n", failed ? "FAILED" : "passed");
+	return failed;
+}
@@ -0,0 +1,198 @@
+/*
+ * replay.c
+ *
+ * Records and replays input logs of an INPUT_LOG build (make OPTIONS="-DISR_SCHEDULER -DINPUT_LOG").
+ *
+ *   ./replay -r log.bin [-s seed] [-n steps]   plays a game with seeded random buttons and saves its log
+ *   ./replay log.bin [-c count]                replays the log "count" times at full speed
+ *
+ * The log has the layout of the EEPROM of the device, so a game recorded on the device and read out
+ * with "avrdude -U eeprom:r:log.bin:r" replays here as well. Both modes print the final score and a
+ * checksum of the board; a recording is replayed once to check that they match. INPUT_LATENCY builds print p50
+ * and p99 of the input latency of every button after a recording (a replay has no presses to time).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "tetris_native.h"
+
+static uint32_t boardChecksum(void)
+{
+	TetrisState state;
+	uint32_t checksum = 2166136261u; // FNV-1a
+
+	tetrisGetState(&state);
+	for (size_t i = 0; i < sizeof(state.matrix); ++i)
+	{
+		checksum = (checksum ^ state.matrix[i]) * 16777619u;
+	}
+	checksum = (checksum ^ state.current) * 16777619u;
+	checksum = (checksum ^ state.position) * 16777619u;
+	checksum = (checksum ^ state.next) * 16777619u;
+	return checksum;
+}
+
+static uint32_t printResult(const char *mode)
+{
+	TetrisState state;
+	uint32_t checksum = boardChecksum();
+	tetrisGetState(&state);
+	printf("%s: score %u, board %08x\n", mode, state.score, checksum);
+	return checksum;
+}
+
+// formats the upper edge of latency bin "bin" in ms, the last bin has none
+static const char *latencyBin(const TetrisLatency *latency, uint8_t bin, char *text, size_t size)
+{
+	if (bin + 1 >= latency->binCount)
+	{
+		snprintf(text, size, ">%.1fms", (bin * latency->binMicroseconds) / 1000.0);
+	}
+	else
+	{
+		snprintf(text, size, "<%.1fms", ((bin + 1) * latency->binMicroseconds) / 1000.0);
+	}
+	return text;
+}
+
+// prints p50 and p99 of the input latency of every button (INPUT_LATENCY builds only)
+static void printLatency(FILE *file)
+{
+	static const uint8_t buttons[] = { TETRIS_BUTTON_LEFT, TETRIS_BUTTON_DOWN, TETRIS_BUTTON_RIGHT, TETRIS_BUTTON_ROTATION };
+	static const char *names[] = { "left", "down", "right", "rotation" };
+
+	for (int i = 0; i < 4; ++i)
+	{
+		TetrisLatency latency;
+		char p50[32], p99[32];
+		tetrisGetLatency(buttons[i], &latency);
+		if (!latency.binCount)
+		{
+			return;
+		}
+		if (!latency.presses)
+		{
+			fprintf(file, "latency %-8s no presses, %u missed\n", names[i], latency.missed);
+			continue;
+		}
+		fprintf(file, "latency %-8s %u presses, %u missed, p50 %s, p99 %s\n", names[i], latency.presses, latency.missed,
+				latencyBin(&latency, latency.p50Bin, p50, sizeof(p50)), latencyBin(&latency, latency.p99Bin, p99, sizeof(p99)));
+	}
+}
+
+static void replayLog(const uint8_t *log, uint16_t size, unsigned long *records)
+{
+	tetrisReplay(log, size);
+	*records = 1;
+	while (tetrisStep())
+	{
+		++*records;
+	}
+}
+
+static int record(const char *path, unsigned int seed, unsigned long steps)
+{
+	unsigned long step;
+	int running = 1;
+
+	srand(seed);
+	tetrisInit((uint16_t)seed);
+	for (step = 0; running && step < steps; ++step)
+	{
+		uint8_t buttons = 0;
+		if (rand() % 8 == 0)
+		{
+			static const uint8_t choice[] = { TETRIS_BUTTON_LEFT, TETRIS_BUTTON_RIGHT, TETRIS_BUTTON_ROTATION, TETRIS_BUTTON_DOWN };
+			buttons = choice[rand() % 4];
+		}
+		tetrisSetButtons(buttons);
+		tetrisTick(); // one scheduler tick per pass of the game loop
+		running = tetrisStep();
+	}
+
+	uint16_t size;
+	const uint8_t *log = tetrisSaveLog(&size); // done by the game over already, harmless to repeat
+	uint32_t recorded = printResult(running ? "recorded" : "recorded (game over)");
+	fprintf(stderr, "%lu steps, %u bytes of log\n", step, size);
+	printLatency(stdout);
+
+	FILE *file = fopen(path, "wb");
+	if (!file || (fwrite(log, 1, size, file) != size))
+	{
+		perror(path);
+		return 1;
+	}
+	fclose(file);
+
+	static uint8_t copy[65536];
+	unsigned long records;
+	memcpy(copy, log, size);
+	replayLog(copy, size, &records);
+	if (printResult("replayed") != recorded)
+	{
+		fprintf(stderr, "the replay differs from the recording, is the log full (INPUT_LOG_SIZE)?\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int replay(const char *path, unsigned long count)
+{
+	static uint8_t log[65536];
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		perror(path);
+		return 1;
+	}
+	size_t size = fread(log, 1, sizeof(log), file);
+	fclose(file);
+
+	unsigned long records = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < count; ++i)
+	{
+		replayLog(log, (uint16_t)size, &records);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printResult("replayed");
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	fprintf(stderr, "%lu replays of %lu records in %.3fs, %.0f records/s\n", count, records, seconds, records * count / seconds);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *recordPath = NULL;
+	unsigned int seed = 1;
+	unsigned long steps = 100000;
+	unsigned long count = 1;
+	int option;
+
+	while ((option = getopt(argc, argv, "r:s:n:c:")) != -1)
+	{
+		switch (option)
+		{
+			case 'r': recordPath = optarg; break;
+			case 's': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'n': steps = strtoul(optarg, NULL, 0); break;
+			case 'c': count = strtoul(optarg, NULL, 0); break;
+			default: optind = argc + 1; break;
+		}
+	}
+	if (recordPath)
+	{
+		return record(recordPath, seed, steps);
+	}
+	if (optind != argc - 1)
+	{
+		fprintf(stderr, "usage: %s -r log.bin [-s seed] [-n steps] | %s log.bin [-c count]\n", argv[0], argv[0]);
+		return 2;
+	}
+	return replay(argv[optind], count);
+}
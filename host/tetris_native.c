@@ -0,0 +1,277 @@
+/*
+ * tetris_native.c
+ *
+ * Wrappers of the native build. The game is compiled here as a single translation unit,
+ * exactly like on the target, so the static functions of main.c are reachable.
+ */
+
+#include "../tetris/main.c"
+#include "tetris_native.h"
+
+static void tetrisReset(uint16_t seed)
+{
+	memset(matrix, 0, sizeof(matrix));
+	g_score = 0;
+	ROWS_CHANGED(0xFFFF);
+#ifdef EVENT_DRIVEN_RENDERING
+	g_sceneChanged = TRUE;
+#endif
+#ifdef ISR_SCHEDULER
+	g_pendingEvents = 0;
+	g_events = 0;
+#endif
+#ifdef INPUT_LOG
+	g_ticks = 0;
+#endif
+#ifdef ENTROPY_POOL
+	g_entropyPool = 0;
+	g_entropySamples = 0;
+#endif
+#ifdef PIECE_BAG
+	g_bag = 0;
+#endif
+	halNativeEntropySeed(seed);
+}
+
+#ifdef PROFILER
+// lets "counts" units of 64 cycles elapse on the profiler clock
+static void profilerAdvance(uint32_t counts)
+{
+	while (counts--)
+	{
+		if (!++halNativeProfilerCount)
+		{
+			halNativeProfilerIsr();
+		}
+	}
+}
+#endif
+
+void tetrisInit(uint16_t seed)
+{
+	tetrisReset(seed);
+	halNativeButtons = 0;
+	gameInit();
+}
+
+void tetrisSetButtons(uint8_t buttons)
+{
+	halNativeButtons = buttons;
+}
+
+void tetrisAdvanceTimer(uint16_t counts)
+{
+	halNativeTimerAdvance(counts);
+#if defined(PROFILER) && !defined(ISR_SCHEDULER)
+	profilerAdvance((uint32_t)counts * (1024/64)); // the game time runs on the gravity timer
+#endif
+}
+
+void tetrisTick(void)
+{
+#ifdef ISR_SCHEDULER
+#ifdef PROFILER
+	profilerAdvance((uint32_t)TICK_TIMER_COUNTS * (1024/64)); // the game time runs on the tick, which ends the period
+#endif
+	halNativeTick();
+#endif
+}
+
+#ifdef IDLE_SLEEP
+static HAL_THREAD_LOCAL unsigned long idleTicksInFlight;
+
+// runs idle() up to the sleep which only the next tick would end, and counts it when a frame is still in flight:
+// its runs are started by the SPI interrupt waking the CPU, without a tick in between
+static void idleUntilTick(void)
+{
+	if (setjmp(halNativeSleepJump))
+	{
+#ifdef LCD_SPI_INTERRUPT
+		if (LcdTxBusy)
+		{
+			++idleTicksInFlight;
+		}
+#endif
+		return;
+	}
+	idle();
+}
+
+unsigned long tetrisIdleTicksInFlight(void)
+{
+	return idleTicksInFlight;
+}
+#endif
+
+int tetrisStep(void)
+{
+	if (setjmp(halNativeHaltJump))
+	{
+		return 0; // GAME OVER
+	}
+	gameStep();
+#ifdef IDLE_SLEEP
+	idleUntilTick();
+#endif
+	LcdWaitForUpdate(); // the runs of a frame are started by the main loop of the target, which goes on meanwhile
+	return 1;
+}
+
+void tetrisAdcSample(void)
+{
+#ifdef ENTROPY_POOL
+	halNativeAdcIsr();
+#endif
+}
+
+uint8_t tetrisTetrominoSpec(uint8_t tetromino)
+{
+	return tetrominos[tetromino];
+}
+
+uint8_t tetrisRandomTetromino(void)
+{
+	randomizeNextTetromino();
+	return nextTetromino;
+}
+
+int tetrisCanPlace(uint8_t tetromino, uint8_t position, uint8_t storeMode)
+{
+	return canPlaceTetromino(tetromino, position, (TStoreMode)storeMode);
+}
+
+uint8_t tetrisDropPosition(uint8_t tetromino, uint8_t position)
+{
+#ifdef COLUMN_HEIGHTS
+	return dropPosition(tetromino, position);
+#else
+	while (canPlaceTetromino(tetromino, position + 8, check))
+	{
+		position += 8;
+	}
+	return position;
+#endif
+}
+
+int tetrisMoveDown(void)
+{
+	if (setjmp(halNativeHaltJump))
+	{
+		return 0; // GAME OVER
+	}
+	moveTetrominoDown();
+	return 1;
+}
+
+void tetrisDisplayScene(void)
+{
+	displayScene();
+	LcdWaitForUpdate();
+}
+
+uint8_t *tetrisLcdCache(void)
+{
+#ifdef LCD_NO_FRAMEBUFFER
+	return NULL;
+#else
+	return LcdCache;
+#endif
+}
+
+uint16_t tetrisLcdCacheIndex(uint8_t x, uint8_t bank)
+{
+	return LCD_CACHE_INDEX(x, bank);
+}
+
+void tetrisLcdBar(uint8_t x, uint8_t y, uint8_t width, uint8_t height)
+{
+#ifndef LCD_NO_FRAMEBUFFER
+	LcdBar(x, y, width, height);
+#endif
+}
+
+void tetrisDrawTile(uint8_t x, uint8_t y)
+{
+#ifndef LCD_NO_FRAMEBUFFER
+	drawTile(x, y);
+#endif
+}
+
+void tetrisGetState(TetrisState *state)
+{
+	state->current = currentTetromino;
+	state->position = currentTetrominoPosition;
+	state->next = nextTetromino;
+	state->score = g_score;
+	memcpy(state->matrix, matrix, sizeof(matrix));
+}
+
+void tetrisSetState(const TetrisState *state)
+{
+	currentTetromino = state->current;
+	currentTetrominoPosition = state->position;
+	nextTetromino = state->next;
+	g_score = state->score;
+	memcpy(matrix, state->matrix, sizeof(matrix));
+#ifdef COLUMN_HEIGHTS
+	computeColumnHeights();
+#endif
+	ROWS_CHANGED(0xFFFF);
+	SCENE_CHANGED();
+}
+
+void tetrisSetCurrent(uint8_t tetromino, uint8_t position)
+{
+	currentTetromino = tetromino;
+	currentTetrominoPosition = position;
+	SCENE_CHANGED();
+}
+
+const uint8_t *tetrisSaveLog(uint16_t *size)
+{
+#ifdef INPUT_LOG
+	logSave();
+	*size = LOG_HEADER_SIZE + (halNativeLog[0] | (halNativeLog[1] << 8));
+#else
+	*size = 0;
+#endif
+	return halNativeLog;
+}
+
+void tetrisReplay(const uint8_t *log, uint16_t size)
+{
+	memcpy(halNativeLog, log, size); // HAL_LOG_SIZE holds any uint16_t size
+	tetrisReset(1);
+	halNativeButtons = TETRIS_BUTTON_ROTATION; // held at power on
+	gameInit();
+	halNativeButtons = 0;
+}
+
+#if defined(INPUT_LATENCY) && (LATENCY_BINS > TETRIS_LATENCY_MAX_BINS)
+#error "LATENCY_BINS does not fit TetrisLatency"
+#endif
+
+void tetrisGetLatency(uint8_t button, TetrisLatency *latency)
+{
+	memset(latency, 0, sizeof(*latency));
+#ifdef INPUT_LATENCY
+	uint8_t index = __builtin_ctz(button);
+	latency->binCount = LATENCY_BINS;
+	latency->binMicroseconds = ((uint32_t)64 << LATENCY_BIN_SHIFT) / (F_CPU / 1000000);
+	memcpy(latency->bins, g_latencyHistogram[index], LATENCY_BINS);
+	for (uint8_t bin = 0; bin < LATENCY_BINS; ++bin)
+	{
+		latency->presses += latency->bins[bin];
+	}
+	latency->missed = g_latencyMissed[index];
+	latency->p50Bin = latencyPercentile(index, 50);
+	latency->p99Bin = latencyPercentile(index, 99);
+#else
+	(void)button;
+#endif
+}
+
+void tetrisSetLcdSink(void (*sink)(uint8_t data, uint8_t isData))
+{
+	halNativeSpiSink = sink;
+}
@@ -0,0 +1,110 @@
+/*
+ * tetris_native.h
+ *
+ * Native (host) build of the game core. The library compiles tetris/main.c together with
+ * the LCD driver against the mock I/O of hal_native.h, so the same canPlaceTetromino(),
+ * moveTetrominoDown() and displayScene() code that runs on the ATmega8 can be driven,
+ * tested and measured on the host.
+ */
+
+#ifndef TETRIS_NATIVE_H_
+#define TETRIS_NATIVE_H_
+
+#include <stdint.h>
+
+// button bits, as read from PIND on the target
+#define TETRIS_BUTTON_LEFT     0x01
+#define TETRIS_BUTTON_DOWN     0x02
+#define TETRIS_BUTTON_RIGHT    0x04
+#define TETRIS_BUTTON_ROTATION 0x08
+
+// store modes of tetrisCanPlace()
+#define TETRIS_CHECK 0
+#define TETRIS_STORE 1
+#define TETRIS_DRAW  2
+#define TETRIS_GHOST 3 // GHOST_PIECE builds only
+
+#define TETRIS_NEXT_POSITION (3 + 8*19) // where displayScene() draws the next tetromino (NEXT_TETROMINO_POSITION)
+
+typedef struct
+{
+	uint8_t current; // tetromino*4 + orientation
+	uint8_t position; // x + 8*y
+	uint8_t next;
+	uint8_t score;
+	uint8_t matrix[16]; // one bit per block, see main.c
+} TetrisState;
+
+// Clears the board and the score, seeds the entropy source and runs gameInit().
+void tetrisInit(uint16_t seed);
+
+// Sets the buttons held from now on (TETRIS_BUTTON_* bits).
+void tetrisSetButtons(uint8_t buttons);
+
+// Lets "counts" ticks of the 1024 prescaler elapse on the gravity timer.
+void tetrisAdvanceTimer(uint16_t counts);
+
+// Runs the scheduler tick interrupt once (ISR_SCHEDULER builds only).
+void tetrisTick(void);
+
+// Runs one pass of the game loop. Returns 0 once the game is over.
+int tetrisStep(void);
+
+// Number of passes whose idle() would have waited for a tick with a frame still in flight (IDLE_SLEEP builds only).
+// tetrisStep() runs idle() up to the sleep which only the next tick would end.
+unsigned long tetrisIdleTicksInFlight(void);
+
+// Runs the ADC conversion complete interrupt once (ENTROPY_POOL builds only).
+void tetrisAdcSample(void);
+
+// Returns the specification of "tetromino" from tetrominos[] (3x3 blocks, see canPlaceTetromino()).
+uint8_t tetrisTetrominoSpec(uint8_t tetromino);
+
+// Draws the next tetromino as randomizeNextTetromino() does and returns it (shape*4, orientation 0).
+uint8_t tetrisRandomTetromino(void);
+
+// Direct access to the hot paths of the game core.
+int tetrisCanPlace(uint8_t tetromino, uint8_t position, uint8_t storeMode);
+int tetrisMoveDown(void); // returns 0 once the game is over
+uint8_t tetrisDropPosition(uint8_t tetromino, uint8_t position); // where the tetromino lands, from the column heights when built with them
+void tetrisDisplayScene(void);
+uint8_t *tetrisLcdCache(void); // the 504 bytes drawn by displayScene(), NULL in LCD_NO_FRAMEBUFFER builds
+uint16_t tetrisLcdCacheIndex(uint8_t x, uint8_t bank); // where the byte of column "x" in "bank" is, see LCD_VERTICAL_ADDRESSING
+void tetrisLcdBar(uint8_t x, uint8_t y, uint8_t width, uint8_t height); // LcdBar(), no-op in LCD_NO_FRAMEBUFFER builds
+void tetrisDrawTile(uint8_t x, uint8_t y); // drawTile(), no-op in LCD_NO_FRAMEBUFFER builds
+
+void tetrisGetState(TetrisState *state);
+void tetrisSetState(const TetrisState *state);
+// Moves the falling tetromino without touching the rest of the state, as a move of gameStep() does.
+void tetrisSetCurrent(uint8_t tetromino, uint8_t position);
+
+// Input log (INPUT_LOG builds only), in the layout of the EEPROM of the device. tetrisInit() starts
+// a recording. tetrisSaveLog() saves it, as the game over does, and returns its address and size.
+// tetrisReplay() starts a new game driven by a log instead of the buttons; tetrisStep() replays one
+// record per call with no pacing and returns 0 at the end of the log.
+const uint8_t *tetrisSaveLog(uint16_t *size);
+void tetrisReplay(const uint8_t *log, uint16_t size);
+
+// Input latency (PROFILER and INPUT_LATENCY builds only), see INPUT_LATENCY in README.md. The game time runs on
+// tetrisAdvanceTimer(), or on tetrisTick() in ISR_SCHEDULER builds, and the buttons are sampled every 256 units
+// of 64 cycles of it, as the profiler interrupt does on the target.
+#define TETRIS_LATENCY_MAX_BINS 64
+
+typedef struct
+{
+	uint8_t binCount; // 0 in the builds without INPUT_LATENCY
+	uint32_t binMicroseconds; // bin i counts the presses shown within (i+1)*binMicroseconds, the last bin all the slower ones
+	uint8_t bins[TETRIS_LATENCY_MAX_BINS]; // halved whenever one of them is full, as on the target
+	uint16_t presses; // the sum of the bins
+	uint16_t missed; // presses which made no move before the next press of the button
+	uint8_t p50Bin; // bins holding the percentiles, binCount with no presses
+	uint8_t p99Bin;
+} TetrisLatency;
+
+// Gets the latency histogram of "button" (one TETRIS_BUTTON_* bit).
+void tetrisGetLatency(uint8_t button, TetrisLatency *latency);
+
+// Receives every byte sent to the LCD together with the state of the D/C pin (1 for data).
+void tetrisSetLcdSink(void (*sink)(uint8_t data, uint8_t isData));
+
+#endif /* TETRIS_NATIVE_H_ */
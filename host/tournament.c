@@ -0,0 +1,456 @@
+/*
+ * tournament.c
+ *
+ * Self-play tournament: plays many games with a placement heuristic on all cores and reports
+ * the speed of the harness, the lines per game and the fairness of the tetromino generator.
+ *
+ *   ./tournament [-g games] [-j threads] [-p maxPieces] [-s seed] [-h heuristic]
+ *
+ * Every game runs the game core of libtetris.a: the moves are checked with canPlaceTetromino()
+ * on the "matrix" bitboard and stored by moveTetrominoDown(), which also removes the full lines
+ * and draws the next tetromino with myrand(). The state of the game is thread local in the
+ * native build, so each worker thread plays its own games.
+ *
+ * The games are split into one range per worker. A worker takes its games one by one from the
+ * front of its range and, once the range is empty, steals the back half of the range of another
+ * worker. Game n is played with seed+n whichever worker plays it, so the results do not depend
+ * on the number of threads. The native entropy source has a 16-bit state, so there are at most
+ * 65535 different tetromino sequences.
+ *
+ * A heuristic scores the board after a placement (higher is better); the best placement among
+ * all orientations and columns reachable from the initial position is played. Add a function
+ * and a line to "heuristics" to try another one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "tetris_native.h"
+
+#define SHAPES 8
+#define CHI_SQUARE_CRITICAL 24.322 // 7 degrees of freedom, 0.1% significance
+
+typedef int (*Evaluate)(const uint8_t matrix[16], int lines, uint32_t *random);
+
+typedef struct
+{
+	const char *name;
+	Evaluate evaluate;
+	const char *description;
+} Heuristic;
+
+typedef struct
+{
+	uint64_t pieces;
+	uint64_t shapes[SHAPES];
+	uint64_t steals;
+	uint32_t longestWait; // most tetrominos in a row without some shape
+	uint32_t limitReached; // games stopped at the piece limit
+} Totals;
+
+typedef struct
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	uint32_t next; // games [next, end) are not started yet
+	uint32_t end;
+	Totals totals;
+} Worker;
+
+static Worker *workers;
+static int workerCount;
+static const Heuristic *heuristic;
+static uint32_t maxPieces = 1000;
+static uint16_t baseSeed = 1;
+static uint32_t *linesPerGame;
+
+static uint32_t xorshift32(uint32_t *state)
+{
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+// column heights (0 for an empty column), holes and bumpiness of a board
+static void boardFeatures(const uint8_t matrix[16], int *aggregateHeight, int *holes, int *bumpiness)
+{
+	int height[8];
+	*aggregateHeight = 0;
+	*holes = 0;
+	*bumpiness = 0;
+	for (int x = 0; x < 8; ++x)
+	{
+		uint8_t mask = 0x80 >> x;
+		int row = 0;
+		while ((row < 16) && !(matrix[row] & mask))
+		{
+			++row;
+		}
+		height[x] = 16 - row;
+		*aggregateHeight += height[x];
+		for (; row < 16; ++row)
+		{
+			if (!(matrix[row] & mask))
+			{
+				++*holes;
+			}
+		}
+		if (x)
+		{
+			*bumpiness += abs(height[x] - height[x - 1]);
+		}
+	}
+}
+
+static int evaluateRandom(const uint8_t matrix[16], int lines, uint32_t *random)
+{
+	(void)matrix;
+	(void)lines;
+	return (int)(xorshift32(random) >> 1);
+}
+
+static int evaluateLowest(const uint8_t matrix[16], int lines, uint32_t *random)
+{
+	int aggregateHeight, holes, bumpiness;
+	(void)lines;
+	(void)random;
+	boardFeatures(matrix, &aggregateHeight, &holes, &bumpiness);
+	return -aggregateHeight;
+}
+
+static int evaluateWeighted(const uint8_t matrix[16], int lines, uint32_t *random)
+{
+	int aggregateHeight, holes, bumpiness;
+	(void)random;
+	boardFeatures(matrix, &aggregateHeight, &holes, &bumpiness);
+	return -51 * aggregateHeight + 76 * lines - 36 * holes - 18 * bumpiness;
+}
+
+static const Heuristic heuristics[] =
+{
+	{ "weighted", evaluateWeighted, "height, lines, holes and bumpiness with weights tuned for Tetris" },
+	{ "lowest", evaluateLowest, "the lowest aggregate height" },
+	{ "random", evaluateRandom, "a random reachable placement" },
+};
+
+// the rotation of gameStep()
+static uint8_t rotate(uint8_t tetromino)
+{
+	return ((tetromino & 0x03) == 0) ? (tetromino | 0x03) : (uint8_t)(tetromino - 1);
+}
+
+// removes the full rows of "matrix" and returns their number
+static int removeFullRows(uint8_t matrix[16])
+{
+	int to = 15;
+	for (int from = 15; from >= 0; --from)
+	{
+		if (matrix[from] != 0xFF)
+		{
+			matrix[to--] = matrix[from];
+		}
+	}
+	int lines = to + 1;
+	while (to >= 0)
+	{
+		matrix[to--] = 0;
+	}
+	return lines;
+}
+
+typedef struct
+{
+	const TetrisState *state; // the board before the placement
+	uint32_t *random;
+	int found;
+	int score;
+	uint8_t tetromino;
+	uint8_t position;
+} Choice;
+
+// scores "tetromino" dropped from "position" in the top row and keeps it if it is the best so far
+static void consider(Choice *choice, uint8_t tetromino, uint8_t position)
+{
+	TetrisState after;
+	tetrisCanPlace(tetromino, tetrisDropPosition(tetromino, position), TETRIS_STORE);
+	tetrisGetState(&after);
+	tetrisSetState(choice->state);
+	int lines = removeFullRows(after.matrix);
+	int score = heuristic->evaluate(after.matrix, lines, choice->random);
+	if (!choice->found || (score > choice->score))
+	{
+		choice->found = 1;
+		choice->score = score;
+		choice->tetromino = tetromino;
+		choice->position = position;
+	}
+}
+
+// plays the best placement of the current tetromino; returns 0 at game over
+static int playTetromino(uint32_t *random)
+{
+	TetrisState state;
+	tetrisGetState(&state);
+	uint8_t tetromino = state.current;
+	uint8_t start = state.position;
+	Choice choice = { &state, random, 0, 0, tetromino, start };
+
+	for (int rotation = 0; rotation < 4; ++rotation)
+	{
+		if (rotation)
+		{
+			tetromino = rotate(tetromino);
+			if (!tetrisCanPlace(tetromino, start, TETRIS_CHECK)) // blocked, as in gameStep()
+			{
+				break;
+			}
+		}
+		consider(&choice, tetromino, start);
+		// slide left, then right, along the top row while nothing is in the way
+		for (int step = -1; step <= 1; step += 2)
+		{
+			uint8_t position = start;
+			while (((position & 0x07) != ((step < 0) ? 0 : 7)) && tetrisCanPlace(tetromino, (uint8_t)(position + step), TETRIS_CHECK))
+			{
+				position = (uint8_t)(position + step);
+				consider(&choice, tetromino, position);
+			}
+		}
+	}
+
+	state.current = choice.tetromino;
+	state.position = tetrisDropPosition(choice.tetromino, choice.position);
+	tetrisSetState(&state);
+	return tetrisMoveDown(); // it cannot move down, so it is stored and the next tetromino comes
+}
+
+static void playGame(uint32_t game, Totals *totals)
+{
+	uint32_t random = 2463534242u ^ (game * 2654435761u);
+	uint32_t lastSeen[SHAPES] = { 0 };
+	uint32_t lines = 0;
+	uint32_t pieces = 0;
+	int running = 1;
+
+	if (!random)
+	{
+		random = 1;
+	}
+	tetrisInit((uint16_t)(baseSeed + game));
+	while (running && (pieces < maxPieces))
+	{
+		TetrisState state;
+		tetrisGetState(&state);
+		int shape = state.current >> 2;
+		++totals->shapes[shape];
+		++pieces;
+		if (pieces - lastSeen[shape] - 1 > totals->longestWait)
+		{
+			totals->longestWait = pieces - lastSeen[shape] - 1;
+		}
+		lastSeen[shape] = pieces;
+
+		uint8_t score = state.score;
+		running = playTetromino(&random);
+		tetrisGetState(&state);
+		lines += (uint8_t)(state.score - score); // the score counts the lines in 8 bits
+	}
+	if (running)
+	{
+		++totals->limitReached;
+	}
+	totals->pieces += pieces;
+	linesPerGame[game] = lines;
+}
+
+// takes the next game of "self", stealing half of the games of another worker when it has none left
+static int takeGame(Worker *self, uint32_t *game)
+{
+	pthread_mutex_lock(&self->lock);
+	int taken = self->next < self->end;
+	if (taken)
+	{
+		*game = self->next++;
+	}
+	pthread_mutex_unlock(&self->lock);
+	if (taken)
+	{
+		return 1;
+	}
+
+	int id = (int)(self - workers);
+	for (int i = 1; i < workerCount; ++i)
+	{
+		Worker *victim = &workers[(id + i) % workerCount];
+		pthread_mutex_lock(&victim->lock);
+		uint32_t begin = victim->next + (victim->end - victim->next) / 2;
+		uint32_t end = victim->end;
+		if (begin < end)
+		{
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if (begin < end)
+		{
+			pthread_mutex_lock(&self->lock);
+			self->next = begin + 1;
+			self->end = end;
+			pthread_mutex_unlock(&self->lock);
+			++self->totals.steals;
+			*game = begin;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void *workerMain(void *argument)
+{
+	Worker *self = argument;
+	uint32_t game;
+	while (takeGame(self, &game))
+	{
+		playGame(game, &self->totals);
+	}
+	return NULL;
+}
+
+static int compareLines(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-g games] [-j threads] [-p maxPieces] [-s seed] [-h heuristic]\nheuristics:\n", program);
+	for (size_t i = 0; i < sizeof(heuristics) / sizeof(heuristics[0]); ++i)
+	{
+		fprintf(stderr, "  %-10s %s\n", heuristics[i].name, heuristics[i].description);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t games = 10000;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int option;
+
+	workerCount = (cores > 0) ? (int)cores : 1;
+	heuristic = &heuristics[0];
+	while ((option = getopt(argc, argv, "g:j:p:s:h:")) != -1)
+	{
+		switch (option)
+		{
+			case 'g': games = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'j': workerCount = atoi(optarg); break;
+			case 'p': maxPieces = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 's': baseSeed = (uint16_t)strtoul(optarg, NULL, 0); break;
+			case 'h':
+				heuristic = NULL;
+				for (size_t i = 0; i < sizeof(heuristics) / sizeof(heuristics[0]); ++i)
+				{
+					if (!strcmp(optarg, heuristics[i].name))
+					{
+						heuristic = &heuristics[i];
+					}
+				}
+				if (!heuristic)
+				{
+					usage(argv[0]);
+					return 2;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if ((workerCount < 1) || !games)
+	{
+		usage(argv[0]);
+		return 2;
+	}
+
+	workers = calloc(workerCount, sizeof(Worker));
+	linesPerGame = calloc(games, sizeof(uint32_t));
+	if (!workers || !linesPerGame)
+	{
+		perror("calloc");
+		return 1;
+	}
+
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	for (int i = 0; i < workerCount; ++i)
+	{
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].next = (uint32_t)((uint64_t)games * i / workerCount);
+		workers[i].end = (uint32_t)((uint64_t)games * (i + 1) / workerCount);
+	}
+	for (int i = 0; i < workerCount; ++i)
+	{
+		if (pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]))
+		{
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	Totals totals;
+	memset(&totals, 0, sizeof(totals));
+	for (int i = 0; i < workerCount; ++i)
+	{
+		pthread_join(workers[i].thread, NULL);
+		Totals *t = &workers[i].totals;
+		totals.pieces += t->pieces;
+		totals.steals += t->steals;
+		totals.limitReached += t->limitReached;
+		if (t->longestWait > totals.longestWait)
+		{
+			totals.longestWait = t->longestWait;
+		}
+		for (int shape = 0; shape < SHAPES; ++shape)
+		{
+			totals.shapes[shape] += t->shapes[shape];
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+	uint64_t lines = 0;
+	for (uint32_t game = 0; game < games; ++game)
+	{
+		lines += linesPerGame[game];
+	}
+	qsort(linesPerGame, games, sizeof(uint32_t), compareLines);
+
+	printf("heuristic %s, %u games of at most %u tetrominos, %d threads\n", heuristic->name, games, maxPieces, workerCount);
+	printf("speed: %.0f games/s, %.0f tetrominos/s (%.2fs, %llu steals)\n", games / seconds,
+			totals.pieces / seconds, seconds, (unsigned long long)totals.steals);
+	printf("lines per game: mean %.2f, 10%% %u, median %u, 90%% %u, max %u; %u games reached the limit\n",
+			(double)lines / games, linesPerGame[games / 10], linesPerGame[games / 2],
+			linesPerGame[games - 1 - games / 10], linesPerGame[games - 1], totals.limitReached);
+
+	static const char *names = "IJLoSTZ.";
+	double expected = (double)totals.pieces / SHAPES;
+	double chiSquare = 0;
+	printf("tetrominos:");
+	for (int shape = 0; shape < SHAPES; ++shape)
+	{
+		double difference = totals.shapes[shape] - expected;
+		chiSquare += difference * difference / expected;
+		printf(" %c %.2f%%", names[shape], 100.0 * totals.shapes[shape] / totals.pieces);
+	}
+	printf("\nchi-square %.3f (critical %.3f): %s; longest wait for a shape %u tetrominos\n", chiSquare,
+			CHI_SQUARE_CRITICAL, (chiSquare < CHI_SQUARE_CRITICAL) ? "uniform" : "NOT uniform", totals.longestWait);
+
+	free(linesPerGame);
+	free(workers);
+	return 0;
+}
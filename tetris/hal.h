@@ -0,0 +1,169 @@
+/*
+ * hal.h
+ *
+ * Hardware abstraction layer of the game and the LCD driver: buttons, gravity timer, tick timer,
+ * entropy source, SPI byte sink and the LCD control pins.
+ * The ATmega8 implementation below maps every operation directly to the registers, so it costs nothing.
+ * When TETRIS_NATIVE is defined the mock I/O of the host build (host/hal_native.h) is used instead.
+ */
+
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#ifdef TETRIS_NATIVE
+#include "hal_native.h"
+#else
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+/* ATMega8 port pinout for LCD. */
+/* 0.2.6 bug, fixed */
+#define LCD_PORT                   PORTB
+#define LCD_DDR                    DDRB
+#define LCD_DC_PIN                 PB0  /* Pin 0 */
+#define LCD_CE_PIN                 PB2  /* Pin 2 */
+#define SPI_MOSI_PIN               PB3  /* Pin 3 */
+#define LCD_RST_PIN                PB4  /* Pin 4 */
+#define SPI_CLK_PIN                PB5  /* Pin 5 */
+
+// qualifier of the state of the game and of the LCD driver, thread local in the host build
+#define HAL_THREAD_LOCAL
+
+// buttons: PD0 left, PD1 down, PD2 right, PD3 rotation; a pressed button reads as 1
+#define HAL_BUTTONS() (PIND)
+
+// gravity timer: Timer1 overflows after "counts" ticks of the 1024 prescaler
+#define HAL_TIMER_START(counts) \
+	do { \
+		TIFR = (1 << TOV1); /* reset the overflow flag (by writing '1') */ \
+		TCNT1 = 65535-(counts); \
+		TCCR1B = (1 << CS10) | (1 << CS12); /* start the timer by setting 1024 prescaler */ \
+	} while (0)
+#define HAL_TIMER_EXPIRED() ((TIFR & (1 << TOV1) ) > 0)
+
+// scheduler tick: Timer2 compare match interrupt every "counts" ticks of the 1024 prescaler
+#define HAL_TICK_START(counts) \
+	do { \
+		OCR2 = (counts) - 1; \
+		TCCR2 = (1 << WGM21) | (1 << CS22) | (1 << CS21) | (1 << CS20); /* CTC mode, 1024 prescaler */ \
+		TIMSK |= (1 << OCIE2); \
+	} while (0)
+#define HAL_TICK_VECTOR TIMER2_COMP_vect
+
+// entropy source: noise of the unconnected ADC0 pin
+#define HAL_ENTROPY_INIT() \
+	do { \
+		ADMUX = (1 << REFS0) | (1 << REFS1); /* ADC0 + internal 2.56V reference */ \
+		ADCSRA = (1 << ADPS2) | (1 << ADPS1) /* 64 prescaler */ \
+				| (1 << ADEN);    /* Enable the ADC */ \
+	} while (0)
+
+static inline uint16_t halEntropyRead(void)
+{
+	ADCSRA |= (1<<ADSC); // run ADC conversion once
+	while(ADCSRA & (1<<ADSC)); // wait until ADC conversion finishes
+	return ADC;
+}
+
+// the same ADC free running, with an interrupt after every conversion (ENTROPY_POOL)
+#define HAL_ENTROPY_START() \
+	do { \
+		ADMUX = (1 << REFS0) | (1 << REFS1); /* ADC0 + internal 2.56V reference */ \
+		ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADFR) | (1 << ADIE) /* free running with interrupt */ \
+				| (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0); /* 128 prescaler: an interrupt every 1664 cycles */ \
+	} while (0)
+#define HAL_ENTROPY_VECTOR ADC_vect
+#define HAL_ENTROPY_SAMPLE() (ADC)
+#define HAL_ENTROPY_WAIT() // the samples come from the interrupt
+
+// storage of the input log (INPUT_LOG): the EEPROM, so a recording survives power off and can be read out
+#define HAL_LOG_SIZE (E2END + 1)
+#define HAL_LOG_READ(index) eeprom_read_byte((const uint8_t *)(uint16_t)(index))
+#define HAL_LOG_SAVE(buffer, size) eeprom_update_block((buffer), (void *)0, (size))
+#define HAL_REPLAY_PACING 1 // a replay runs at the recorded speed
+
+// SPI byte sink of the LCD
+#define HAL_SPI_INIT() (SPCR = 0x50) // No interrupt, MSBit first, Master mode, CPOL->0, CPHA->0, Clk/4
+#define HAL_SPI_INIT_CLK2() do { SPCR = 0x50; SPSR = _BV( SPI2X ); } while (0) // the same with SPI2X: Clk/2
+#define HAL_SPI_WRITE(data) (SPDR = (data))
+#define HAL_SPI_WAIT() while ( !(SPSR & 0x80) )
+#define HAL_SPI_CLEAR_FLAG() ((void)SPSR) // reading SPSR followed by the SPDR access clears a pending SPIF
+#define HAL_SPI_INTERRUPT_ENABLE() (SPCR |= _BV( SPIE ))
+#define HAL_SPI_INTERRUPT_DISABLE() (SPCR &= ~_BV( SPIE ))
+#define HAL_SPI_VECTOR SPI_STC_vect
+
+// LCD control pins
+#define HAL_LCD_INIT_PINS() \
+	do { \
+		/* Set output bits on LCD Port. */ \
+		LCD_DDR |= _BV( LCD_RST_PIN ) | _BV( LCD_DC_PIN ) | _BV( LCD_CE_PIN ) | _BV( SPI_MOSI_PIN ) | _BV( SPI_CLK_PIN ); \
+		/* Toggle display reset pin. */ \
+		LCD_PORT |= _BV ( LCD_RST_PIN ); \
+	} while (0)
+#define HAL_LCD_DATA_MODE() (LCD_PORT |= _BV( LCD_DC_PIN ))
+#define HAL_LCD_COMMAND_MODE() (LCD_PORT &= ~( _BV( LCD_DC_PIN ) ))
+
+// idle (IDLE_SLEEP): the Idle sleep mode stops only the CPU clock, so the timers, the ADC and the SPI keep running
+// and any of their interrupts wakes the CPU up. The buttons cannot (only PD2 and PD3 have external interrupts),
+// the scheduler tick samples them instead.
+#define HAL_SLEEP_INIT() \
+	do { \
+		set_sleep_mode(SLEEP_MODE_IDLE); \
+		ACSR = (1 << ACD); /* the analog comparator is not used */ \
+	} while (0)
+// enables the interrupts and sleeps; "sei" delays the interrupts by one instruction, so none can slip in before
+// "sleep" and leave the CPU asleep with a pending event
+#define HAL_SLEEP() \
+	do { \
+		sleep_enable(); \
+		sei(); \
+		sleep_cpu(); \
+		sleep_disable(); \
+	} while (0)
+
+// profiler clock (PROFILER): Timer0 counts the CPU clock divided by 64 and its overflow interrupt counts the
+// overflows; Timer1 (gravity) and Timer2 (tick) are not touched
+#define HAL_PROFILER_START() \
+	do { \
+		TCNT0 = 0; \
+		TCCR0 = (1 << CS01) | (1 << CS00); /* 64 prescaler: an overflow every 16384 cycles */ \
+		TIMSK |= (1 << TOIE0); \
+	} while (0)
+#define HAL_PROFILER_COUNT() (TCNT0)
+#define HAL_PROFILER_OVERFLOWED() ((TIFR & (1 << TOV0)) != 0) // an overflow the interrupt has not counted yet
+#define HAL_PROFILER_VECTOR TIMER0_OVF_vect
+
+// interrupts
+#define HAL_ISR(vector) ISR(vector)
+#define HAL_DISABLE_INTERRUPTS() cli()
+#define HAL_ENABLE_INTERRUPTS() sei()
+
+// benchmark markers: the cycle benchmark (bench/) runs the firmware under simavr, which
+// timestamps every write to the otherwise unused EEDR register
+#ifdef TETRIS_BENCH
+#include "bench.h"
+#define HAL_BENCH_MARK(marker) \
+	do { \
+		__asm__ __volatile__ ("" ::: "memory"); \
+		EEDR = (marker); \
+	} while (0)
+#else
+#define HAL_BENCH_MARK(marker)
+#endif
+
+// stops the game (game over, failed assert)
+#ifdef TETRIS_BENCH
+#define HAL_HALT() do { HAL_BENCH_MARK(BENCH_HALT); while(1){} } while (0)
+#else
+#define HAL_HALT() while(1){}
+#endif
+#define HAL_ASSERT_FAILED(file, line) ((void)0)
+
+#endif // TETRIS_NATIVE
+
+#endif /* HAL_H_ */
@@ -10,20 +10,50 @@
 #define __ASSERT_USE_STDERR
 //#define NDEBUG
 
-#include <avr/io.h>
-#include <avr/pgmspace.h>
+// Optional features (all of them are disabled in the 1KB contest build)
+//#define EVENT_DRIVEN_RENDERING // compose and send a frame only when the game state has changed
+//#define FAST_TILE_BLITTER      // drawTile() writes whole LcdCache bytes instead of calling LcdBar()
+//#define STATIC_BACKGROUND      // the screen decoration is drawn once, displayScene() repaints only the game areas
+//#define COLLISION_TABLES       // canPlaceTetromino() uses precomputed row masks (768B of flash) instead of walking the blocks
+//#define FAST_LINE_CLEAR        // full lines are removed in a single pass over the rows of the stored tetromino and above
+//#define ISR_SCHEDULER          // gravity and debounced, auto-repeated buttons come from a Timer2 tick interrupt
+//#define INPUT_LOG              // records the seed and the events of a game, holding rotation at power on replays it (needs ISR_SCHEDULER)
+//#define ENTROPY_POOL           // the ADC runs free, its interrupt mixes the noise into a pool seeding a xorshift generator
+//#define PIECE_BAG              // each of the 8 shapes comes once in every bag of 8 (needs ENTROPY_POOL or INPUT_LOG)
+//#define COLUMN_HEIGHTS         // the height of every column is kept up to date, the landing row of a tetromino comes from table lookups
+//#define HARD_DROP              // pressing left and right together drops the tetromino at once (needs COLUMN_HEIGHTS)
+//#define GHOST_PIECE            // the landing position of the falling tetromino is drawn with outlined tiles (needs COLUMN_HEIGHTS)
+//#define IDLE_SLEEP             // the CPU sleeps until the next event or frame (needs ISR_SCHEDULER and EVENT_DRIVEN_RENDERING)
+//#define DIRTY_ROWS             // displayScene() composes only the playfield rows which have changed since the last frame (needs STATIC_BACKGROUND)
+//#define PROFILER               // the sections of the main loop are timed with Timer0, holding down and rotation shows the times (not with NDEBUG)
+//#define INPUT_LATENCY          // histograms of the time from a button press to the frame showing its move, holding left and rotation shows them (needs PROFILER)
+
+#ifndef F_CPU
+#define F_CPU 8000000UL // internal RC oscillator
+#endif
+
+#include "hal.h"
 #include <stdlib.h>
 #include <string.h>
 #include "my_assert.h"
 
 #include "pcd8544.h"
 #include "pcd8544.c"
+#ifdef COLLISION_TABLES
+#include "tetromino_masks.h"
+#endif
+#ifdef COLUMN_HEIGHTS
+#include "tetromino_profiles.h"
+#endif
 
 typedef enum
 {
 	check = 0,
 	store = 1,
-	draw = 2
+	draw = 2,
+#ifdef GHOST_PIECE
+	ghost = 3
+#endif
 } TStoreMode;
 
 const uint8_t tetrominos[8*4] = { // there are 8 tetrominos, each of them has 4 orientations (0, 90deg., 180deg., and 270deg.)
@@ -38,47 +68,743 @@ const uint8_t tetrominos[8*4] = { // there are 8 tetrominos, each of them has 4
 };
 
 // Global variables
-uint8_t currentTetromino; // tetromino currently being dropped
-uint8_t currentTetrominoPosition; // linear position of tetromino on screen calculated as x+8*y
-uint8_t nextTetromino; // tetromino next to be dropped once current finished
+HAL_THREAD_LOCAL uint8_t currentTetromino; // tetromino currently being dropped
+HAL_THREAD_LOCAL uint8_t currentTetrominoPosition; // linear position of tetromino on screen calculated as x+8*y
+HAL_THREAD_LOCAL uint8_t nextTetromino; // tetromino next to be dropped once current finished
 #define NEXT_TETROMINO_POSITION (3 + 8*19) // (X + 8*Y) position
 
-uint8_t matrix[16] =  // 16rows, 8 blocks per row, each block is represented by one bit
+HAL_THREAD_LOCAL uint8_t matrix[16] =  // 16rows, 8 blocks per row, each block is represented by one bit
 {
 	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0
 };
 
-uint8_t g_score = 0;
+HAL_THREAD_LOCAL uint8_t g_score = 0;
+
+#if defined(COLLISION_TABLES) || defined(LCD_NO_FRAMEBUFFER) || defined(DIRTY_ROWS)
+// returns the blocks of "row" (0-2) of "tetromino" placed in column "xPos"; the same bit order as in "matrix"
+static uint8_t tetrominoRowMask(uint8_t tetromino, uint8_t xPos, uint8_t row)
+{
+#ifdef COLLISION_TABLES
+	return pgm_read_byte(&tetrominoRowMasks[tetromino][xPos][row]);
+#else
+	uint8_t tetrominoSpec = tetrominos[tetromino];
+	uint8_t rowBits; // 3 blocks of the row, the most significant bit is the left-most block
+	if (row == 0)
+	{
+		rowBits = tetrominoSpec >> 5;
+	}
+	else if (row == 1)
+	{
+		rowBits = (tetrominoSpec >> 2) & 0x07;
+	}
+	else
+	{
+		rowBits = (tetrominoSpec << 1) & 0x06;
+	}
+	return (rowBits << 5) >> xPos;
+#endif
+}
+#endif
+
+#if (defined(HARD_DROP) || defined(GHOST_PIECE)) && !defined(COLUMN_HEIGHTS)
+#error "HARD_DROP and GHOST_PIECE find the landing position with COLUMN_HEIGHTS"
+#endif
+#if defined(GHOST_PIECE) && defined(LCD_NO_FRAMEBUFFER)
+#error "GHOST_PIECE draws its tiles into LcdCache"
+#endif
+
+#ifdef COLUMN_HEIGHTS
+#define EMPTY_COLUMN_HEIGHT 16 // height of a column without blocks (the row below the bottom)
+
+HAL_THREAD_LOCAL uint8_t g_columnHeights[8]; // row of the top-most block of every column of "matrix"
+
+// recomputes all column heights from "matrix"; called at init and after full lines are removed
+static void computeColumnHeights()
+{
+	memset(g_columnHeights, EMPTY_COLUMN_HEIGHT, sizeof(g_columnHeights));
+	uint8_t found = 0; // columns whose top-most block has been found
+	uint8_t row;
+	for (row = 0; (row < 16) && (found != 0xFF); ++row)
+	{
+		uint8_t newBlocks = matrix[row] & ~found;
+		if (newBlocks)
+		{
+			found |= newBlocks;
+			uint8_t x;
+			for (x = 0; x < 8; ++x)
+			{
+				if (newBlocks & (0x80 >> x))
+				{
+					g_columnHeights[x] = row;
+				}
+			}
+		}
+	}
+}
+
+// raises the columns covered by "tetromino" just stored in "position"
+static void addColumnHeights(uint8_t tetromino, uint8_t position)
+{
+	uint8_t xPos = position & 0x7;
+	uint8_t yPos = position >> 3;
+	uint8_t tops = pgm_read_byte(&tetrominoTops[tetromino]);
+	uint8_t column;
+	for (column = 0; column < 3; ++column, tops >>= 2)
+	{
+		uint8_t top = tops & 0x03;
+		if (top == 3) // no block in this column of the tetromino
+		{
+			continue;
+		}
+		top += yPos;
+		if (top < g_columnHeights[xPos + column])
+		{
+			g_columnHeights[xPos + column] = top;
+		}
+	}
+}
+#endif
+
+#if defined(DIRTY_ROWS) && (!defined(STATIC_BACKGROUND) || defined(LCD_NO_FRAMEBUFFER))
+#error "DIRTY_ROWS keeps the unchanged rows in LcdCache between the frames, which needs STATIC_BACKGROUND"
+#endif
+#if defined(LCD_DIRTY_UPDATE) && !defined(DIRTY_ROWS) && !defined(LCD_DIRTY_SHADOW)
+#error "LCD_DIRTY_UPDATE saves nothing when every frame redraws the whole screen, it needs DIRTY_ROWS or LCD_DIRTY_SHADOW"
+#endif
+
+#ifdef DIRTY_ROWS
+HAL_THREAD_LOCAL uint16_t g_dirtyRows = 0xFFFF; // bit y is set when row y of the playfield has to be composed again
+#define ROWS_CHANGED(rows) (g_dirtyRows |= (rows))
+#else
+#define ROWS_CHANGED(rows)
+#endif
+#ifdef STATIC_BACKGROUND
+#define NO_TETROMINO 0xFF // not a tetromino, their 2 lowest bits are 0
+HAL_THREAD_LOCAL uint8_t g_drawnNextTetromino = NO_TETROMINO; // the preview as it is drawn in LcdCache, NO_TETROMINO redraws it and the score bar
+HAL_THREAD_LOCAL uint8_t g_drawnScore; // the score bar as it is drawn in LcdCache
+#endif
+#define TETROMINO_ROWS(top) ((uint16_t)(0x07u << (top))) // rows "top" to "top"+2
+#define ROWS_DOWN_TO(bottom) ((uint16_t)((2u << (bottom)) - 1)) // rows 0 to "bottom"
+
+#ifdef NDEBUG
+#undef PROFILER // a debugging aid, displayed like the assert messages
+#undef INPUT_LATENCY
+#endif
+#if defined(PROFILER) && defined(LCD_NO_FRAMEBUFFER)
+#error "PROFILER displays its readout with LcdStr(), which needs LcdCache"
+#endif
+#if defined(INPUT_LATENCY) && !defined(PROFILER)
+#error "INPUT_LATENCY runs on the clock of PROFILER"
+#endif
+
+#ifdef PROFILER
+// sections of the main loop timed by the profiler
+typedef enum
+{
+	PROFILE_INPUT = 0,     // rotation, left and right
+	PROFILE_MOVE_DOWN = 1, // moveTetrominoDown()
+	PROFILE_COMPOSE = 2,   // displayScene() without LcdUpdate()
+	PROFILE_LCD_UPDATE = 3,
+	PROFILE_SECTIONS = 4
+} TProfileSection;
+
+typedef struct
+{
+	uint16_t min; // in units of 64 CPU cycles
+	uint16_t max;
+	uint32_t sum;
+	uint16_t count; // stops at 65535, so the average stays right
+} TProfileStats;
+
+HAL_THREAD_LOCAL TProfileStats g_profile[PROFILE_SECTIONS];
+HAL_THREAD_LOCAL volatile uint8_t g_profilerOverflows; // the high byte of the profiler clock
+HAL_THREAD_LOCAL uint8_t g_profilerShown; // the readout on the screen
+
+#define READOUT_NONE 0
+#define READOUT_TIMES 1
+#define READOUT_LATENCY 2 // INPUT_LATENCY builds only
+
+static void profilerInit()
+{
+	uint8_t section;
+	memset(g_profile, 0, sizeof(g_profile));
+	for (section = 0; section < PROFILE_SECTIONS; ++section)
+	{
+		g_profile[section].min = 0xFFFF;
+	}
+	HAL_PROFILER_START();
+	HAL_ENABLE_INTERRUPTS();
+}
 
-#define LEFT_BUTTON_PRESSED (PIND & (1<<PD0)) // returns TRUE if left button is pressed
-#define RIGHT_BUTTON_PRESSED (PIND & (1<<PD2)) // returns TRUE if right button is pressed
-#define DOWN_BUTTON_PRESSED (PIND & (1<<PD1)) // returns TRUE if down button is pressed
-#define ROTATION_BUTTON_PRESSED (PIND & (1<<PD3)) // returns TRUE if rotation button is pressed
-#define TIMER_HAS_EXPIRED ((TIFR & (1 << TOV1) ) > 0) // returns TRUE if timer has expired
+// returns the profiler clock: 16 bits in units of 64 CPU cycles, it wraps every 0.52s at 8MHz
+static uint16_t profilerClock()
+{
+	HAL_DISABLE_INTERRUPTS();
+	uint8_t high = g_profilerOverflows;
+	uint8_t low = HAL_PROFILER_COUNT();
+	if (HAL_PROFILER_OVERFLOWED() && (low < 0x80)) // the count has wrapped since the interrupts were disabled
+	{
+		++high;
+	}
+	HAL_ENABLE_INTERRUPTS();
+	return (high << 8) | low;
+}
+
+// adds the time since "start" to the statistics of "section"; returns the start of the next section
+static uint16_t profilerRecord(TProfileSection section, uint16_t start)
+{
+	uint16_t elapsed = profilerClock() - start;
+	TProfileStats *stats = &g_profile[section];
+	if (stats->count != 0xFFFF)
+	{
+		if (elapsed < stats->min)
+		{
+			stats->min = elapsed;
+		}
+		if (elapsed > stats->max)
+		{
+			stats->max = elapsed;
+		}
+		stats->sum += elapsed;
+		++stats->count;
+	}
+	return profilerClock(); // the bookkeeping above is not counted
+}
+
+#define PROFILE_START() uint16_t profileStart = profilerClock()
+#define PROFILE_STOP(section) (profileStart = profilerRecord((section), profileStart))
+#else
+#define PROFILE_START()
+#define PROFILE_STOP(section)
+#endif
+
+#ifdef EVENT_DRIVEN_RENDERING
+HAL_THREAD_LOCAL bool g_sceneChanged = TRUE; // set whenever anything drawn by displayScene() has changed
+#define SCENE_CHANGED() (g_sceneChanged = TRUE)
+#else
+#define SCENE_CHANGED()
+#endif
+
+#if defined(INPUT_LOG) && !defined(ISR_SCHEDULER)
+#error "INPUT_LOG records the events of ISR_SCHEDULER"
+#endif
+#if defined(IDLE_SLEEP) && (!defined(ISR_SCHEDULER) || !defined(EVENT_DRIVEN_RENDERING))
+#error "IDLE_SLEEP is woken up by the tick of ISR_SCHEDULER and needs EVENT_DRIVEN_RENDERING to know when a frame is due"
+#endif
+
+#ifdef ISR_SCHEDULER
+#define TICK_HZ 100 // frequency of the scheduler tick
+#define TICK_TIMER_COUNTS (F_CPU/1024/TICK_HZ) // Timer2 counts per tick (1024 prescaler)
+#define TIMER1_COUNTS_PER_TICK (F_CPU/1024/TICK_HZ) // converts the Timer1 period of startTimer() to ticks
+#define BUTTON_DELAY_TICKS 17 // 170ms before a held button starts repeating
+#define BUTTON_REPEAT_TICKS 5 // then it repeats every 50ms
+#define BUTTONS_MASK ((1<<PD0) | (1<<PD1) | (1<<PD2) | (1<<PD3))
+#define REPEATED_BUTTONS_MASK ((1<<PD0) | (1<<PD1) | (1<<PD2)) // rotation is not repeated
+#define EVENT_GRAVITY 0x80 // button events use the HAL_BUTTONS() bits of the buttons
+
+HAL_THREAD_LOCAL volatile uint8_t g_pendingEvents; // events generated by the tick interrupt and not taken by the main loop yet
+HAL_THREAD_LOCAL volatile uint8_t g_gravityTicks; // ticks left until the next gravity step
+HAL_THREAD_LOCAL uint8_t g_events; // events handled in the current main loop
+
+#ifdef INPUT_LOG
+// The log is the seed of the random number generator followed by the events taken by the main loop, so a replay
+// gives the same game whatever the speed of the loop is. Each record is one byte: the events (bits 0-3 and 7) and
+// the ticks since the previous record (bits 4-6), with 7 meaning that the ticks follow in the next byte.
+// The recording is kept in SRAM and saved at game over, the layout is the same on the device (EEPROM) and on the host.
+#ifndef INPUT_LOG_SIZE
+#define INPUT_LOG_SIZE 256 // bytes of SRAM for the recording, header included
+#endif
+#if INPUT_LOG_SIZE > HAL_LOG_SIZE
+#error "INPUT_LOG_SIZE does not fit the log storage"
+#endif
+#define LOG_HEADER_SIZE 4 // length of the records (2 bytes), seed (2 bytes)
+#define LOG_TICKS_SHIFT 4
+#define LOG_TICKS_MASK 0x70
+#define LOG_LONG_TICKS 7
+
+HAL_THREAD_LOCAL volatile uint8_t g_ticks; // tick counter
+HAL_THREAD_LOCAL uint8_t g_logTicks; // tick of the previous record
+HAL_THREAD_LOCAL bool g_replaying; // the events come from the saved log, the buttons are ignored
+HAL_THREAD_LOCAL uint16_t g_logIndex; // next byte of the log to read or write
+HAL_THREAD_LOCAL uint16_t g_logEnd; // end of the log being replayed
+HAL_THREAD_LOCAL uint8_t g_log[INPUT_LOG_SIZE]; // the recording
+#endif
+
+#define LEFT_BUTTON_PRESSED (g_events & (1<<PD0)) // returns TRUE if left button was pressed or repeated
+#define RIGHT_BUTTON_PRESSED (g_events & (1<<PD2)) // returns TRUE if right button was pressed or repeated
+#define DOWN_BUTTON_PRESSED (g_events & (1<<PD1)) // returns TRUE if down button was pressed or repeated
+#define ROTATION_BUTTON_PRESSED (g_events & (1<<PD3)) // returns TRUE if rotation button was pressed
+#define TIMER_HAS_EXPIRED (g_events & EVENT_GRAVITY) // returns TRUE if it is time for the gravity step
+#define HARD_DROP_PRESSED ((g_events & HARD_DROP_BUTTONS) == HARD_DROP_BUTTONS) // returns TRUE if left and right were pressed together
+#else
+#ifdef HARD_DROP
+#define LEFT_BUTTON_PRESSED ((HAL_BUTTONS() & HARD_DROP_BUTTONS) == (1<<PD0)) // returns TRUE if left button is pressed without right
+#define RIGHT_BUTTON_PRESSED ((HAL_BUTTONS() & HARD_DROP_BUTTONS) == (1<<PD2)) // returns TRUE if right button is pressed without left
+#else
+#define LEFT_BUTTON_PRESSED (HAL_BUTTONS() & (1<<PD0)) // returns TRUE if left button is pressed
+#define RIGHT_BUTTON_PRESSED (HAL_BUTTONS() & (1<<PD2)) // returns TRUE if right button is pressed
+#endif
+#define DOWN_BUTTON_PRESSED (HAL_BUTTONS() & (1<<PD1)) // returns TRUE if down button is pressed
+#define ROTATION_BUTTON_PRESSED (HAL_BUTTONS() & (1<<PD3)) // returns TRUE if rotation button is pressed
+#define TIMER_HAS_EXPIRED (HAL_TIMER_EXPIRED()) // returns TRUE if timer has expired
+#define HARD_DROP_PRESSED (hardDropPressed()) // returns TRUE once when left and right are pressed together
+#endif
+
+#ifdef INPUT_LATENCY
+// The latency of a press is the time from the first sample of the buttons showing it to the end of the LcdUpdate()
+// of the frame with its move. The buttons are sampled by the profiler interrupt (every 2ms at 8MHz) and, in the
+// polled builds, by the game loop, which may see a press first. A replay is not timed, its log has no presses.
+#define LATENCY_BUTTONS ((1<<PD0) | (1<<PD1) | (1<<PD2) | (1<<PD3)) // left, down, right, rotation: a histogram per PIND bit
+#define LATENCY_BUTTON_COUNT 4
+#ifndef LATENCY_BINS
+#define LATENCY_BINS 32 // bytes of SRAM per button
+#endif
+#define LATENCY_BIN_SHIFT 10 // 1024 units of the profiler clock (8.2ms at 8MHz) per bin, the last one counts all the slower presses
+
+HAL_THREAD_LOCAL uint8_t g_latencyHistogram[LATENCY_BUTTON_COUNT][LATENCY_BINS]; // halved when a bin is full, so the percentiles stay right
+HAL_THREAD_LOCAL uint16_t g_latencyMissed[LATENCY_BUTTON_COUNT]; // presses which have made no move before the next press of the button
+HAL_THREAD_LOCAL uint16_t g_latencyPress[LATENCY_BUTTON_COUNT]; // profiler clock of the first sample showing the press
+HAL_THREAD_LOCAL volatile uint8_t g_latencyHeld; // buttons held in the latest sample
+HAL_THREAD_LOCAL volatile uint8_t g_latencyWaiting; // pressed, not acted on by the game loop yet
+HAL_THREAD_LOCAL volatile uint8_t g_latencyHandled; // acted on, their move is in the next frame
+HAL_THREAD_LOCAL volatile uint8_t g_latencyFrame; // their move is in the frame being sent
+HAL_THREAD_LOCAL uint8_t g_latencyMoved; // buttons whose action has moved or rotated the tetromino in this pass of the game loop
+#define LATENCY_MOVED(buttons) (g_latencyMoved |= (buttons))
+
+static void latencyInit()
+{
+	memset(g_latencyHistogram, 0, sizeof(g_latencyHistogram));
+	memset(g_latencyMissed, 0, sizeof(g_latencyMissed));
+	g_latencyHeld = HAL_BUTTONS() & LATENCY_BUTTONS; // the buttons held at power on are not presses
+	g_latencyWaiting = 0;
+	g_latencyHandled = 0;
+	g_latencyFrame = 0;
+	g_latencyMoved = 0;
+}
+
+// called with the interrupts disabled: starts timing the buttons of "sample" which were not held in the previous one
+static void latencySample(uint16_t now, uint8_t sample)
+{
+#ifdef INPUT_LOG
+	if (g_replaying)
+	{
+		return;
+	}
+#endif
+	uint8_t pressed = sample & ~g_latencyHeld & ~(g_latencyHandled | g_latencyFrame); // a press whose move is on its way is timed once
+	uint8_t button;
+	g_latencyHeld = sample;
+	for (button = 0; button < LATENCY_BUTTON_COUNT; ++button)
+	{
+		if (pressed & (1 << button))
+		{
+			if ((g_latencyWaiting & (1 << button)) && (g_latencyMissed[button] != 0xFFFF))
+			{
+				++g_latencyMissed[button];
+			}
+			g_latencyPress[button] = now;
+		}
+	}
+	g_latencyWaiting |= pressed;
+}
+
+// called with the interrupts disabled: adds the latency of the presses of "buttons", whose frame has been sent by "now"
+static void latencyRecord(uint8_t buttons, uint16_t now)
+{
+	uint8_t button;
+	for (button = 0; button < LATENCY_BUTTON_COUNT; ++button)
+	{
+		if (buttons & (1 << button))
+		{
+			uint8_t *histogram = g_latencyHistogram[button];
+			uint16_t bin = (uint16_t)(now - g_latencyPress[button]) >> LATENCY_BIN_SHIFT;
+			if (bin >= LATENCY_BINS)
+			{
+				bin = LATENCY_BINS - 1;
+			}
+			if (histogram[bin] == 0xFF)
+			{
+				uint8_t i;
+				for (i = 0; i < LATENCY_BINS; ++i)
+				{
+					histogram[i] >>= 1;
+				}
+			}
+			++histogram[bin];
+		}
+	}
+}
+
+#ifndef ISR_SCHEDULER
+// samples the buttons for the game loop, which reads them right after
+static void latencyPoll()
+{
+	uint16_t now = profilerClock();
+	uint8_t sample = HAL_BUTTONS() & LATENCY_BUTTONS;
+	HAL_DISABLE_INTERRUPTS();
+	latencySample(now, sample);
+	HAL_ENABLE_INTERRUPTS();
+}
+#endif
+
+// the presses waiting for the game loop whose button has moved the tetromino (LATENCY_MOVED()) go to the next frame.
+// The others stay waiting: a blocked rotation or a move into a wall is no move, and the next press of the button
+// counts such a press as missed.
+static void latencyHandled()
+{
+	HAL_DISABLE_INTERRUPTS();
+	uint8_t buttons = g_latencyMoved & g_latencyWaiting;
+	g_latencyWaiting &= ~buttons;
+	g_latencyHandled |= buttons;
+	HAL_ENABLE_INTERRUPTS();
+	g_latencyMoved = 0;
+}
+
+// called when a frame is composed: the previous one has been sent
+static void latencyFrameStart()
+{
+	uint16_t now = profilerClock();
+	HAL_DISABLE_INTERRUPTS();
+	latencyRecord(g_latencyFrame, now);
+	g_latencyFrame = 0;
+	HAL_ENABLE_INTERRUPTS();
+}
+
+// called after LcdUpdate(): the frame has been sent, or the profiler interrupt times its end
+static void latencyFrameSent()
+{
+	uint16_t now = profilerClock();
+	HAL_DISABLE_INTERRUPTS();
+	if (LCD_UPDATE_IN_PROGRESS)
+	{
+		g_latencyFrame = g_latencyHandled;
+	}
+	else
+	{
+		latencyRecord(g_latencyHandled, now);
+	}
+	g_latencyHandled = 0;
+	HAL_ENABLE_INTERRUPTS();
+}
+
+// returns the bin of "button" holding the "percent" percentile of its latency, LATENCY_BINS with no presses
+static uint8_t latencyPercentile(uint8_t button, uint8_t percent)
+{
+	const uint8_t *histogram = g_latencyHistogram[button];
+	uint16_t presses = 0;
+	uint16_t below = 0;
+	uint8_t bin;
+	for (bin = 0; bin < LATENCY_BINS; ++bin)
+	{
+		presses += histogram[bin];
+	}
+	for (bin = 0; bin < LATENCY_BINS; ++bin)
+	{
+		below += histogram[bin];
+		if ((presses) && ((uint32_t)below * 100 >= (uint32_t)presses * percent))
+		{
+			break;
+		}
+	}
+	return bin;
+}
+#endif
+
+#ifdef PROFILER
+HAL_ISR(HAL_PROFILER_VECTOR)
+{
+	++g_profilerOverflows;
+#ifdef INPUT_LATENCY
+	uint16_t now = (g_profilerOverflows << 8) | HAL_PROFILER_COUNT(); // the interrupts are disabled, profilerClock() would enable them
+	latencySample(now, HAL_BUTTONS() & LATENCY_BUTTONS);
+	if ((g_latencyFrame) && (!LCD_UPDATE_IN_PROGRESS)) // the frame of the moves has been sent
+	{
+		latencyRecord(g_latencyFrame, now);
+		g_latencyFrame = 0;
+	}
+#endif
+}
+#endif
+
+#define HARD_DROP_BUTTONS ((1<<PD0) | (1<<PD2)) // left and right
+
+#if defined(HARD_DROP) && !defined(ISR_SCHEDULER)
+HAL_THREAD_LOCAL bool g_hardDropHeld; // the chord was complete in the previous pass of the game loop
+
+// returns TRUE in the pass of the game loop which sees the chord complete, so that a held chord drops one tetromino only
+static bool hardDropPressed()
+{
+	bool held = ((HAL_BUTTONS() & HARD_DROP_BUTTONS) == HARD_DROP_BUTTONS);
+	bool pressed = held && !g_hardDropHeld;
+	g_hardDropHeld = held;
+	return pressed;
+}
+#endif
+
+#if defined(PIECE_BAG) && !defined(ENTROPY_POOL) && !defined(INPUT_LOG)
+#error "PIECE_BAG draws from the generator of ENTROPY_POOL or INPUT_LOG"
+#endif
+
+#ifdef ENTROPY_POOL
+#define ENTROPY_INIT_SAMPLES 16 // samples mixed into the pool before the first tetromino, about 3ms
+
+HAL_THREAD_LOCAL volatile uint16_t g_entropyPool; // noise of the ADC, mixed in by the conversion complete interrupt
+HAL_THREAD_LOCAL volatile uint8_t g_entropySamples; // samples taken since gameInit()
+
+// ADC conversion complete: mixes the noise of the unconnected ADC0 pin into the pool
+HAL_ISR(HAL_ENTROPY_VECTOR)
+{
+	uint16_t pool = g_entropyPool;
+	g_entropyPool = ((pool << 3) | (pool >> 13)) ^ HAL_ENTROPY_SAMPLE();
+	++g_entropySamples;
+}
+#endif
+
+#if defined(ENTROPY_POOL) || defined(INPUT_LOG)
+HAL_THREAD_LOCAL uint16_t g_randomState; // xorshift generator of the tetrominos, never 0
+
+static uint8_t randomByte()
+{
+	g_randomState ^= g_randomState << 7;
+	g_randomState ^= g_randomState >> 9;
+	g_randomState ^= g_randomState << 8;
+#ifndef INPUT_LOG
+	// fresh noise on top; a torn read of the pool is still noise. A replay has to follow the seed of the log alone.
+	return (g_randomState >> 8) ^ g_entropyPool;
+#else
+	return g_randomState >> 8;
+#endif
+}
+#endif
+
+#ifdef PIECE_BAG
+HAL_THREAD_LOCAL uint8_t g_bag; // shapes left in the current bag, one bit each
+#endif
 
 static uint8_t myrand()
 {
-	static uint8_t g_randomNumber; // uninitialized value; it is ok to be random at init :)
+#ifdef PIECE_BAG
+	// every shape once per bag, in random order; the rejected draws cost about 2 more randomByte() calls per tetromino
+	if (!g_bag)
+	{
+		g_bag = 0xFF;
+	}
+	uint8_t shape;
+	do
+	{
+		shape = randomByte() & 0x07;
+	} while (!(g_bag & (1 << shape)));
+	g_bag &= ~(1 << shape);
+	return shape << 2;
+#elif defined(ENTROPY_POOL) || defined(INPUT_LOG)
+	return randomByte() & 0x1C;
+#else
+	static HAL_THREAD_LOCAL uint8_t g_randomNumber; // uninitialized value; it is ok to be random at init :)
 	// we use ADC conversion of unconnected ATMEGA ADC pin to read the noise. The noise is added (XOR) to randomized value to make it more random.
-	ADCSRA |= (1<<ADSC); // run ADC conversion once
-	while(ADCSRA & (1<<ADSC)); // wait until ADC conversion finishes
-
-	g_randomNumber = (g_randomNumber<<1)^ADC;
+	g_randomNumber = (g_randomNumber<<1)^halEntropyRead();
 	return g_randomNumber & 0x1C;
+#endif
 }
 
 void startTimer()
 {
-	TIFR = (1 << TOV1); // reset the overflow flag (by writing '1')
-	TCNT1 = 65535-3580+(g_score*10); // starting from about 0.5s period
-	TCCR1B = (1 << CS10) | (1 << CS12); // start the timer by setting 1024 prescaler
+#ifdef ISR_SCHEDULER
+	// the same period as the Timer1 one below, counted in ticks
+	uint8_t ticks = (3580-(g_score*10)) / TIMER1_COUNTS_PER_TICK;
+	HAL_DISABLE_INTERRUPTS();
+	g_gravityTicks = ticks;
+	g_pendingEvents &= ~EVENT_GRAVITY;
+	HAL_ENABLE_INTERRUPTS();
+#else
+	HAL_TIMER_START(3580-(g_score*10)); // starting from about 0.5s period
+#endif
+}
+
+#ifdef ISR_SCHEDULER
+// scheduler tick: debounces the buttons, generates press and auto-repeat events and the gravity steps
+HAL_ISR(HAL_TICK_VECTOR)
+{
+	static HAL_THREAD_LOCAL uint8_t lastSample; // buttons sampled in the previous tick
+	static HAL_THREAD_LOCAL uint8_t buttons; // debounced buttons
+	static HAL_THREAD_LOCAL uint8_t repeatTicks; // ticks left until the held buttons are repeated
+	uint8_t events = 0;
+
+	uint8_t sample = HAL_BUTTONS() & BUTTONS_MASK;
+	if (sample == lastSample) // the same value in two ticks in a row is not a bounce
+	{
+		uint8_t pressed = sample & ~buttons;
+		buttons = sample;
+		if (pressed)
+		{
+			events = pressed;
+#ifdef HARD_DROP
+			if ((pressed & HARD_DROP_BUTTONS) && ((buttons & HARD_DROP_BUTTONS) == HARD_DROP_BUTTONS)) // the chord is complete
+			{
+				events |= HARD_DROP_BUTTONS;
+			}
+#endif
+			repeatTicks = BUTTON_DELAY_TICKS;
+		}
+		else if (!(buttons & REPEATED_BUTTONS_MASK))
+		{
+			repeatTicks = BUTTON_DELAY_TICKS; // released: nothing left over from this hold for the next one
+		}
+		else if (!--repeatTicks)
+		{
+			events = buttons & REPEATED_BUTTONS_MASK;
+#ifdef HARD_DROP
+			if ((events & HARD_DROP_BUTTONS) == HARD_DROP_BUTTONS) // a held chord drops one tetromino only
+			{
+				events &= ~HARD_DROP_BUTTONS;
+			}
+#endif
+			repeatTicks = BUTTON_REPEAT_TICKS;
+		}
+	}
+	lastSample = sample;
+
+	if (g_gravityTicks && (!--g_gravityTicks))
+	{
+		events |= EVENT_GRAVITY;
+	}
+	g_pendingEvents |= events;
+#ifdef INPUT_LOG
+	++g_ticks;
+#endif
+}
+
+static void startScheduler()
+{
+#ifdef IDLE_SLEEP
+	HAL_SLEEP_INIT();
+#endif
+	HAL_TICK_START(TICK_TIMER_COUNTS);
+	HAL_ENABLE_INTERRUPTS();
+}
+
+#ifdef INPUT_LOG
+// holding the rotation button at power on replays the saved log, a new game is recorded otherwise
+static void logInit()
+{
+	uint16_t seed = 0;
+	g_logIndex = LOG_HEADER_SIZE;
+	g_logTicks = g_ticks;
+	g_replaying = FALSE;
+	if (HAL_BUTTONS() & (1<<PD3))
+	{
+		uint16_t length = HAL_LOG_READ(0) | (HAL_LOG_READ(1) << 8);
+		if (length <= HAL_LOG_SIZE - LOG_HEADER_SIZE) // an erased EEPROM reads 0xFFFF
+		{
+			g_replaying = TRUE;
+			g_logEnd = LOG_HEADER_SIZE + length;
+			seed = HAL_LOG_READ(2) | (HAL_LOG_READ(3) << 8);
+		}
+	}
+	if (!g_replaying)
+	{
+#ifdef ENTROPY_POOL
+		seed = g_entropyPool;
+#else
+		for (uint8_t i = 8; i; --i)
+		{
+			seed = (seed << 2) ^ halEntropyRead();
+		}
+#endif
+		if (!seed)
+		{
+			seed = 1; // xorshift never leaves 0
+		}
+		g_log[2] = seed;
+		g_log[3] = seed >> 8;
+	}
+	g_randomState = seed;
+}
+
+static void logRecord(uint8_t ticks)
+{
+	if (g_logIndex + 2 > INPUT_LOG_SIZE) // the log is full, the rest of the game is not recorded
+	{
+		return;
+	}
+	g_logTicks += ticks;
+	if (ticks < LOG_LONG_TICKS)
+	{
+		g_log[g_logIndex++] = g_events | (ticks << LOG_TICKS_SHIFT);
+	}
+	else
+	{
+		g_log[g_logIndex++] = g_events | (LOG_LONG_TICKS << LOG_TICKS_SHIFT);
+		g_log[g_logIndex++] = ticks;
+	}
 }
 
+// replaces "g_events" with the next record once its ticks have elapsed (at once when HAL_REPLAY_PACING is 0)
+static void logReplay(uint8_t ticks)
+{
+	g_events = 0;
+	if (g_logIndex >= g_logEnd) // end of the log
+	{
+		HAL_HALT();
+	}
+	uint8_t record = HAL_LOG_READ(g_logIndex);
+	uint8_t recordTicks = (record & LOG_TICKS_MASK) >> LOG_TICKS_SHIFT;
+	uint8_t recordSize = 1;
+	if (recordTicks == LOG_LONG_TICKS)
+	{
+		recordTicks = HAL_LOG_READ(g_logIndex + 1);
+		recordSize = 2;
+	}
+	if (HAL_REPLAY_PACING && (ticks < recordTicks))
+	{
+		return;
+	}
+	g_logTicks += recordTicks;
+	g_logIndex += recordSize;
+	g_events = record & ~LOG_TICKS_MASK;
+}
+
+// saves the recording (called at game over)
+static void logSave()
+{
+	if (!g_replaying)
+	{
+		uint16_t length = g_logIndex - LOG_HEADER_SIZE;
+		g_log[0] = length;
+		g_log[1] = length >> 8;
+		HAL_LOG_SAVE(g_log, g_logIndex);
+	}
+}
+#endif
+
+// moves the pending events to "g_events"
+static void takeEvents()
+{
+	HAL_DISABLE_INTERRUPTS();
+	g_events = g_pendingEvents;
+	g_pendingEvents = 0;
+#ifdef INPUT_LOG
+	uint8_t ticks = g_ticks - g_logTicks; // ticks since the previous record
+#endif
+	HAL_ENABLE_INTERRUPTS();
+#ifdef INPUT_LOG
+	if (g_replaying)
+	{
+		logReplay(ticks);
+	}
+	else if (g_events)
+	{
+		logRecord(ticks);
+	}
+#endif
+}
+#endif
+
 static void randomizeNextTetromino()
 {
 	currentTetromino = nextTetromino;
 	currentTetrominoPosition = 3; // top middle initial position of current tetromino
 	nextTetromino = myrand();
+	SCENE_CHANGED();
 
 	assert((currentTetromino >> 2) < 8);	// check if correctly randomized
 	assert((currentTetromino & 0x03) == 0); // ...
@@ -86,12 +812,46 @@ static void randomizeNextTetromino()
 	assert((nextTetromino & 0x03) == 0);	// ...
 }
 
+#ifndef LCD_NO_FRAMEBUFFER
+static void drawBackground()
+{
+	// display screen decoration
+	LcdClear();  // clear LCD screen buffer
+
+	LcdBar(0,0,72,48);
+	LcdBar(0,7,65,34);
+#ifdef STATIC_BACKGROUND
+	g_drawnNextTetromino = NO_TETROMINO; // the preview and the score bar are covered
+#endif
+}
+#endif
+
 static void gameInit()
 {
 	// initialize ADC0 which supports random number generator
-	ADMUX = (1 << REFS0) | (1 << REFS1); // ADC0 + internal 2.56V reference
-	ADCSRA = (1 << ADPS2) | (1 << ADPS1) // 64 prescaler
-			| (1 << ADEN);    // Enable the ADC
+#ifdef ENTROPY_POOL
+	HAL_ENTROPY_START();
+	HAL_ENABLE_INTERRUPTS();
+	while (g_entropySamples < ENTROPY_INIT_SAMPLES)
+	{
+		HAL_ENTROPY_WAIT();
+	}
+	g_randomState = g_entropyPool | 1;
+#else
+	HAL_ENTROPY_INIT();
+#endif
+#ifdef INPUT_LOG
+	logInit();
+#endif
+#ifdef COLUMN_HEIGHTS
+	computeColumnHeights();
+#endif
+#ifdef INPUT_LATENCY
+	latencyInit(); // before the profiler interrupt samples the buttons
+#endif
+#ifdef PROFILER
+	profilerInit();
+#endif
 
 	for (uint8_t i = 8; i; --i)
 	{
@@ -99,11 +859,23 @@ static void gameInit()
 	}
 
 	LcdInit();
+#if defined(STATIC_BACKGROUND) && !defined(LCD_NO_FRAMEBUFFER)
+	drawBackground(); // it stays in LcdCache for the whole game
+#endif
 
 	// initialize the timer
 	startTimer(); // start the timer means to start the game play
+#ifdef ISR_SCHEDULER
+	startScheduler();
+#endif
 }
 
+#if defined(FAST_TILE_BLITTER) || defined(LCD_NO_FRAMEBUFFER) || defined(DIRTY_ROWS)
+// columns of a tile (a 4x4 square with blank 2x2 center), bit 0 is the top pixel
+static const uint8_t tilePattern[4] = { 0x0F, 0x09, 0x09, 0x0F };
+#endif
+
+#ifndef LCD_NO_FRAMEBUFFER
 static void drawTile (uint8_t x, uint8_t y)
 {
 	assert(x<8);
@@ -112,9 +884,53 @@ static void drawTile (uint8_t x, uint8_t y)
 	uint8_t scrX = y*4; // convert virtual coordinates to screen coordinates
 	uint8_t scrY = 48-(8 + x*4)-4;
 
+#ifdef FAST_TILE_BLITTER
+	// scrY is a multiple of 4, so the tile is a nibble of 4 consecutive bytes in one bank
+	uint8_t shift = scrY & 0x04;
+	uint8_t keepMask = ~(0x0F << shift);
+	uint16_t index = LCD_CACHE_INDEX( scrX, scrY >> 3 );
+	uint8_t i;
+	for (i = 0; i < 4; ++i)
+	{
+		LcdCacheWrite( index, (LcdCache[ index ] & keepMask) | (tilePattern[ i ] << shift) );
+		index += LCD_CACHE_X_STEP;
+	}
+#else
 	LcdBar(scrX, scrY, 4,4);
 	LcdBar(scrX+1, scrY+1, 2,2);
+#endif
 }
+#endif
+
+#ifdef GHOST_PIECE
+// draws an outlined tile (only its top and bottom edges) where the current tetromino will land
+static void drawGhostTile (uint8_t x, uint8_t y)
+{
+	assert(x<8);
+	assert(y<16);
+
+	uint8_t scrX = y*4; // convert virtual coordinates to screen coordinates
+	uint8_t scrY = 48-(8 + x*4)-4;
+
+#ifdef FAST_TILE_BLITTER
+	uint8_t shift = scrY & 0x04;
+	uint8_t keepMask = ~(0x0F << shift);
+	uint16_t index = LCD_CACHE_INDEX( scrX, scrY >> 3 );
+	uint8_t i;
+	for (i = 0; i < 4; ++i)
+	{
+		LcdCacheWrite( index, (LcdCache[ index ] & keepMask) | (0x09 << shift) );
+		index += LCD_CACHE_X_STEP;
+	}
+#else
+	LcdBar(scrX, scrY, 4,4);
+	LcdBar(scrX, scrY+1, 4,2);
+#endif
+}
+#define DRAW_TILE(x, y, mode) (((mode) == ghost) ? drawGhostTile((x), (y)) : drawTile((x), (y)))
+#else
+#define DRAW_TILE(x, y, mode) drawTile((x), (y))
+#endif
 
 // this function works in three modes depending on the value of "storePermanently"
 // When storePermanently==check:
@@ -124,6 +940,8 @@ static void drawTile (uint8_t x, uint8_t y)
 //   To run in this mode you have to be sure that you can store the "tetromino" in the "position" by running this function in "check" mode first
 // When storePermanently==draw:
 //   it draws tetromino in "position" without checking anything or touching the "matrix"
+// When storePermanently==ghost (GHOST_PIECE only):
+//   the same as draw, with the outlined tiles of drawGhostTile()
 //
 // "tetromino" contains 3 bits of tetromino number and 2 bits of orientation
 //   bits in tetromino:     MSB  000NNNOO LSB
@@ -139,7 +957,62 @@ static bool canPlaceTetromino(uint8_t tetromino, uint8_t position, TStoreMode st
 {
 	assert(position<136 || position==NEXT_TETROMINO_POSITION);
 	assert(tetromino<8*4);
+	if (storePermanently == store)
+	{
+		ROWS_CHANGED(TETROMINO_ROWS(position >> 3));
+	}
 
+#ifdef COLLISION_TABLES
+	// every row of the tetromino is checked, stored or drawn with a single mask already shifted to its column
+	uint8_t xPos = position & 0x7; // split position into X and Y coordinates
+	uint8_t yPos = position >> 3;
+	if (storePermanently == check)
+	{
+		if ((yPos >= 16) || (xPos > pgm_read_byte(&tetrominoMaxX[tetromino]))) // below the bottom or behind the right wall
+		{
+			return FALSE;
+		}
+	}
+	uint8_t row;
+	for (row = 0; row < 3; ++row, ++yPos)
+	{
+		uint8_t rowMask = tetrominoRowMask(tetromino, xPos, row);
+		if (!rowMask)
+		{
+			continue;
+		}
+		if (storePermanently >= draw)
+		{
+#ifndef LCD_NO_FRAMEBUFFER
+			uint8_t x;
+			for (x = 0; x < 8; ++x)
+			{
+				if (rowMask & (0x80 >> x))
+				{
+					DRAW_TILE(x, yPos, storePermanently);
+				}
+			}
+#endif
+		}
+		else if (storePermanently == store)
+		{
+			assert(yPos<16);
+			matrix[yPos] |= rowMask;
+		}
+		else // if (storePermanently == check)
+		{
+			if (yPos >= 16)
+			{
+				return FALSE;
+			}
+			if (matrix[yPos] & rowMask)
+			{
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+#else
 	// example tetromino specification coded as 0x9A ( 01011100 binary; or 010 111 000 as three rows)
 	//  .#.
 	//  ###
@@ -160,9 +1033,11 @@ static bool canPlaceTetromino(uint8_t tetromino, uint8_t position, TStoreMode st
 		//assert(yPos<18);
 		if (tetrominoSpec&bitMask)
 		{
-			if (storePermanently == draw)
+			if (storePermanently >= draw)
 			{
-				drawTile(xPos, yPos);
+#ifndef LCD_NO_FRAMEBUFFER
+				DRAW_TILE(xPos, yPos, storePermanently);
+#endif
 			}
 			else if (storePermanently == store)
 			{
@@ -193,19 +1068,104 @@ static bool canPlaceTetromino(uint8_t tetromino, uint8_t position, TStoreMode st
 		}
 	}
 	return TRUE;
+#endif
 }
 
+#ifdef COLUMN_HEIGHTS
+// returns the position in which "tetromino" falling from "position" lands
+static uint8_t dropPosition(uint8_t tetromino, uint8_t position)
+{
+	uint8_t xPos = position & 0x7;
+	uint8_t yPos = position >> 3;
+	uint8_t bottoms = pgm_read_byte(&tetrominoBottoms[tetromino]);
+	uint8_t rows = 16; // rows the tetromino can fall
+	uint8_t column;
+	for (column = 0; column < 3; ++column, bottoms >>= 2)
+	{
+		uint8_t bottom = bottoms & 0x03;
+		if (bottom == 3) // no block in this column of the tetromino
+		{
+			continue;
+		}
+		bottom += yPos; // the lowest block of the tetromino in this column
+		uint8_t height = g_columnHeights[xPos + column];
+		if (bottom >= height)
+		{
+			// the tetromino was slid under an overhang, the height does not tell what is below it; probe row by row
+			while (canPlaceTetromino(tetromino, position+8, check))
+			{
+				position += 8;
+			}
+			return position;
+		}
+		if (height - 1 - bottom < rows)
+		{
+			rows = height - 1 - bottom;
+		}
+	}
+	return position + (rows << 3);
+}
+#endif
+
 static void moveTetrominoDown()
 {
+	PROFILE_START();
 	uint8_t newPosition = currentTetrominoPosition+8; // next row
 	if (canPlaceTetromino(currentTetromino, newPosition, check))
 	{
 		currentTetrominoPosition = newPosition;
+		SCENE_CHANGED();
 	}
 	else
 	{ // store current tetromino permanently (in the "matrix") in current location
-		canPlaceTetromino(currentTetromino, currentTetrominoPosition, store);
+		canPlaceTetromino(currentTetromino, currentTetrominoPosition, store); // the scene is marked as changed by randomizeNextTetromino()
+#ifdef COLUMN_HEIGHTS
+		addColumnHeights(currentTetromino, currentTetrominoPosition);
+		uint8_t score = g_score; // changes when full lines are removed
+#endif
 
+#ifdef FAST_LINE_CLEAR
+		// only the rows of the tetromino just stored can be full; they are all removed in one pass
+		// in which every row above them is moved down at most once
+		uint8_t topRow = currentTetrominoPosition >> 3;
+		uint8_t row = topRow + 2;
+		if (row > 15)
+		{
+			row = 15;
+		}
+		uint8_t newRow = row; // where the next remaining row goes
+		uint8_t fullRows = 0;
+		for (; row!=255; --row)
+		{
+			if ((row < topRow) && (!fullRows)) // there is nothing to move
+			{
+				break;
+			}
+			uint8_t line = matrix[row];
+			if ((row >= topRow) && (line == 0xff))
+			{
+				if (!fullRows) // the lowest full row, every row above it moves
+				{
+					ROWS_CHANGED(ROWS_DOWN_TO(row));
+				}
+				++fullRows;
+			}
+			else
+			{
+				matrix[newRow] = line;
+				--newRow;
+			}
+		}
+		if (fullRows)
+		{
+			while (newRow != 255) // clear the rows emptied at the top
+			{
+				matrix[newRow] = 0;
+				--newRow;
+			}
+			g_score += fullRows;
+		}
+#else
 		// verify if there is any full line to drop
 		uint8_t row;
 		for (row=15; row!=255; --row)
@@ -213,6 +1173,7 @@ static void moveTetrominoDown()
 			while (matrix[row] == 0xff) // we found a row full of tiles; "while" loop is used to remove all full lines dropped to "row" position
 			{
 				++g_score;
+				ROWS_CHANGED(ROWS_DOWN_TO(row));
 				// drop all rows above "row" one row down
 				uint8_t rowUp;
 				for (rowUp=row; rowUp>0; --rowUp)
@@ -222,29 +1183,366 @@ static void moveTetrominoDown()
 				matrix[0] = 0;
 			}
 		}
+#endif
+#ifdef COLUMN_HEIGHTS
+		if (g_score != score) // the rows have moved
+		{
+			computeColumnHeights();
+		}
+#endif
 		randomizeNextTetromino();
 		if (!canPlaceTetromino(currentTetromino, currentTetrominoPosition, check))
 		{
 			// GAME OVER
-			while(1){}; // go to infinite loop
+#ifdef INPUT_LOG
+			logSave();
+#endif
+			HAL_HALT(); // go to infinite loop
+		}
+	}
+	PROFILE_STOP(PROFILE_MOVE_DOWN);
+}
+
+
+#ifdef LCD_NO_FRAMEBUFFER
+// rows of tiles to display: "matrix" with the current tetromino (rows 0-15) and the next tetromino (rows 19-20)
+static HAL_THREAD_LOCAL uint8_t sceneRows[21];
+
+// adds "tetromino" in "position" to "sceneRows"
+static void composeTetromino(uint8_t tetromino, uint8_t position)
+{
+	uint8_t xPos = position & 0x7;
+	uint8_t yPos = position >> 3;
+	uint8_t row;
+	for (row = 0; row < 3; ++row)
+	{
+		uint8_t rowMask = tetrominoRowMask(tetromino, xPos, row);
+		if (rowMask)
+		{
+			assert(yPos + row < sizeof(sceneRows));
+			sceneRows[yPos + row] |= rowMask;
 		}
 	}
 }
 
+// returns the LCD byte of screen column "x" in "bank"; called by LcdUpdate() for every byte of the frame
+static uint8_t LcdComposeByte(uint8_t x, uint8_t bank)
+{
+	// screen decoration (see drawBackground())
+	uint8_t value = 0x00;
+	if (x < 72)
+	{
+		value = 0xFF;
+		if (x < 65) // inner frame: blank rows 7-40
+		{
+			if (bank == 0)
+			{
+				value = 0x7F;
+			}
+			else if (bank == 5)
+			{
+				value = 0xFE;
+			}
+			else
+			{
+				value = 0x00;
+			}
+		}
+		if ((bank == 0) && (x >= 2) && (x < 66-(g_score>>2))) // score bar (see showScore())
+		{
+			value &= ~0x08;
+		}
+	}
 
+	// tiles: a screen column belongs to row x/4 and bank holds the tiles of columns 9-2*bank (low nibble) and 8-2*bank (high nibble)
+	uint8_t rowBits = sceneRows[x >> 2];
+	if (rowBits && (bank >= 1) && (bank <= 4))
+	{
+		uint8_t tile = tilePattern[x & 0x03];
+		uint8_t matrixMask = 0x80 >> (9 - 2*bank);
+		if (rowBits & matrixMask)
+		{
+			value = (value & 0xF0) | tile;
+		}
+		if (rowBits & (matrixMask << 1))
+		{
+			value = (value & 0x0F) | (tile << 4);
+		}
+	}
+	return value;
+}
+#else
 static void showScore()
 {
 	LcdBar(2,3,64-(g_score>>2), 1);
 }
+#endif
+
+#ifdef PROFILER
+#define PROFILER_BUTTONS ((1 << PD1) | (1 << PD3)) // down and rotation held together show the readout
+#define LATENCY_READOUT_BUTTONS ((1 << PD0) | (1 << PD3)) // left and rotation held together show the latency readout
+#define PROFILER_FIELD_WIDTH 4
+
+// writes "value" right aligned in PROFILER_FIELD_WIDTH characters, 9999 at most
+static void profilerField(uint8_t *text, uint16_t value)
+{
+	if (value > 9999)
+	{
+		value = 9999;
+	}
+	uint8_t i;
+	for (i = PROFILER_FIELD_WIDTH; i; --i)
+	{
+		text[i-1] = ((value) || (i == PROFILER_FIELD_WIDTH)) ? '0' + value % 10 : ' ';
+		value /= 10;
+	}
+}
+
+// draws min, avg and max of every section (in units of 64 cycles) over the frame in LcdCache
+static void profilerShow()
+{
+	static const char names[PROFILE_SECTIONS][3] = { "in", "dn", "cp", "lc" };
+	uint8_t text[2 + 3*PROFILER_FIELD_WIDTH + 1];
+	uint8_t section;
+
+	LcdGotoXYFont(1,1);
+	LcdStr(FONT_1X, (uint8_t *)"   min avg max");
+	for (section = 0; section < PROFILE_SECTIONS; ++section)
+	{
+		const TProfileStats *stats = &g_profile[section];
+		text[0] = names[section][0];
+		text[1] = names[section][1];
+		profilerField(&text[2], stats->count ? stats->min : 0);
+		profilerField(&text[2 + PROFILER_FIELD_WIDTH], stats->count ? stats->sum / stats->count : 0);
+		profilerField(&text[2 + 2*PROFILER_FIELD_WIDTH], stats->max);
+		text[2 + 3*PROFILER_FIELD_WIDTH] = '\0';
+		LcdGotoXYFont(1, section + 2);
+		LcdStr(FONT_1X, text);
+	}
+	LcdGotoXYFont(1,6);
+	LcdStr(FONT_1X, (uint8_t *)"x64 cycles    ");
+}
+
+#ifdef INPUT_LATENCY
+// returns the upper edge of latency bin "bin" in ms, 9999 for the last bin (it has no upper edge)
+static uint16_t latencyBinMs(uint8_t bin)
+{
+	if (bin >= LATENCY_BINS - 1)
+	{
+		return 9999;
+	}
+	return ((uint32_t)(bin + 1) << LATENCY_BIN_SHIFT) * 64 / (F_CPU / 1000);
+}
+
+// draws p50, p99 (in ms) and the number of presses of every button, and the presses which have made no move
+static void latencyShow()
+{
+	static const char names[LATENCY_BUTTON_COUNT][3] = { "lt", "dn", "rt", "ro" };
+	uint8_t text[2 + 3*PROFILER_FIELD_WIDTH + 1];
+	uint16_t missed = 0;
+	uint8_t button;
+
+	LcdGotoXYFont(1,1);
+	LcdStr(FONT_1X, (uint8_t *)"   p50 p99   n");
+	for (button = 0; button < LATENCY_BUTTON_COUNT; ++button)
+	{
+		uint16_t presses = 0;
+		uint8_t bin;
+		for (bin = 0; bin < LATENCY_BINS; ++bin)
+		{
+			presses += g_latencyHistogram[button][bin];
+		}
+		text[0] = names[button][0];
+		text[1] = names[button][1];
+		profilerField(&text[2], presses ? latencyBinMs(latencyPercentile(button, 50)) : 0);
+		profilerField(&text[2 + PROFILER_FIELD_WIDTH], presses ? latencyBinMs(latencyPercentile(button, 99)) : 0);
+		profilerField(&text[2 + 2*PROFILER_FIELD_WIDTH], presses);
+		text[2 + 3*PROFILER_FIELD_WIDTH] = '\0';
+		LcdGotoXYFont(1, button + 2);
+		LcdStr(FONT_1X, text);
+		missed += g_latencyMissed[button];
+	}
+	profilerField(text, missed);
+	text[PROFILER_FIELD_WIDTH] = '\0';
+	LcdGotoXYFont(1,6);
+	LcdStr(FONT_1X, (uint8_t *)"ms  missed");
+	LcdStr(FONT_1X, text);
+}
+#endif
+
+// shows a readout while its buttons are held, and brings the game screen back once they are released
+static void profilerPoll()
+{
+	uint8_t buttons = HAL_BUTTONS();
+	uint8_t readout = READOUT_NONE;
+	if ((buttons & PROFILER_BUTTONS) == PROFILER_BUTTONS)
+	{
+		readout = READOUT_TIMES;
+	}
+#ifdef INPUT_LATENCY
+	else if ((buttons & LATENCY_READOUT_BUTTONS) == LATENCY_READOUT_BUTTONS)
+	{
+		readout = READOUT_LATENCY;
+	}
+#endif
+	if (readout != READOUT_NONE)
+	{
+		g_profilerShown = readout;
+		SCENE_CHANGED(); // the readout is refreshed in every frame
+	}
+	else if (g_profilerShown)
+	{
+		g_profilerShown = READOUT_NONE;
+#ifdef STATIC_BACKGROUND
+		LcdWaitForUpdate();
+		drawBackground(); // the text has covered the decoration
+		ROWS_CHANGED(0xFFFF);
+#endif
+		SCENE_CHANGED();
+	}
+}
+#endif
+
+#ifdef DIRTY_ROWS
+HAL_THREAD_LOCAL uint8_t g_drawnTetromino; // the falling tetromino as it is drawn in LcdCache
+HAL_THREAD_LOCAL uint8_t g_drawnPosition;
+#ifdef GHOST_PIECE
+HAL_THREAD_LOCAL uint8_t g_drawnGhostPosition;
+#endif
+
+// returns the blocks of "tetromino" in "position" which lie in row "y" of the playfield
+static uint8_t tetrominoRowAt(uint8_t tetromino, uint8_t position, uint8_t y)
+{
+	uint8_t row = y - (position >> 3); // wraps above the tetromino
+	return (row < 3) ? tetrominoRowMask(tetromino, position & 0x07, row) : 0;
+}
+
+// rewrites the 16 LcdCache bytes of row "y" of the playfield (screen columns 4y to 4y+3 of banks 1-4)
+// with the tiles of "tiles" and the outlined tiles of "ghostTiles"
+static void composeRow(uint8_t y, uint8_t tiles, uint8_t ghostTiles)
+{
+	uint8_t i;
+	for (i = 0; i < 4; ++i)
+	{
+		uint16_t index = LCD_CACHE_INDEX(y*4 + i, 1);
+		uint8_t tile = tilePattern[i];
+		uint8_t lowMask = 0x01; // bank 1 holds column 7 in its low nibble and column 6 in its high nibble, bank 4 columns 1 and 0
+		uint8_t bank;
+		for (bank = 0; bank < 4; ++bank, lowMask <<= 2, index += LCD_CACHE_BANK_STEP)
+		{
+			uint8_t highMask = lowMask << 1;
+			uint8_t value = 0x00;
+			if (tiles & lowMask)
+			{
+				value = tile;
+			}
+			else if (ghostTiles & lowMask)
+			{
+				value = 0x09; // see drawGhostTile()
+			}
+			if (tiles & highMask)
+			{
+				value |= tile << 4;
+			}
+			else if (ghostTiles & highMask)
+			{
+				value |= 0x90;
+			}
+			LcdCacheWrite(index, value);
+		}
+	}
+}
+
+// marks the rows the falling tetromino (and its ghost) has left or entered since the last frame and composes all dirty rows
+static void composeDirtyRows()
+{
+#ifdef GHOST_PIECE
+	uint8_t ghostPosition = dropPosition(currentTetromino, currentTetrominoPosition);
+	if ((ghostPosition != g_drawnGhostPosition) || (currentTetromino != g_drawnTetromino))
+	{
+		ROWS_CHANGED(TETROMINO_ROWS(g_drawnGhostPosition >> 3) | TETROMINO_ROWS(ghostPosition >> 3));
+		g_drawnGhostPosition = ghostPosition;
+	}
+#endif
+	if ((currentTetrominoPosition != g_drawnPosition) || (currentTetromino != g_drawnTetromino))
+	{
+		ROWS_CHANGED(TETROMINO_ROWS(g_drawnPosition >> 3) | TETROMINO_ROWS(currentTetrominoPosition >> 3));
+		g_drawnTetromino = currentTetromino;
+		g_drawnPosition = currentTetrominoPosition;
+	}
+
+	uint16_t dirtyRows = g_dirtyRows;
+	g_dirtyRows = 0;
+	uint8_t y;
+	for (y = 0; dirtyRows; ++y, dirtyRows >>= 1)
+	{
+		if (dirtyRows & 0x01)
+		{
+			uint8_t ghostTiles = 0;
+#ifdef GHOST_PIECE
+			ghostTiles = tetrominoRowAt(currentTetromino, ghostPosition, y);
+#endif
+			composeRow(y, matrix[y] | tetrominoRowAt(currentTetromino, currentTetrominoPosition, y), ghostTiles);
+		}
+	}
+}
+#endif
 
 static void displayScene()
 {
-	// display screen decoration
-	memset(LcdCache,0x00,LCD_CACHE_SIZE);  // clear LCD screen buffer
+	if (LCD_UPDATE_POLL()) // the previous frame is still being sent; compose it in one of the next loops
+	{
+		return;
+	}
+#ifdef EVENT_DRIVEN_RENDERING
+	if (!g_sceneChanged) // the frame on the LCD is up to date (a press which has moved the tetromino has changed it)
+	{
+		return;
+	}
+	g_sceneChanged = FALSE;
+#endif
+#ifdef INPUT_LATENCY
+	latencyFrameStart();
+#endif
+	PROFILE_START();
 
-	LcdBar(0,0,72,48);
-	LcdBar(0,7,65,34);
+#ifdef LCD_NO_FRAMEBUFFER
+	// only the rows of tiles are prepared, LcdComposeByte() generates the bytes while they are sent
+	memcpy(sceneRows, matrix, sizeof(matrix));
+	memset(&sceneRows[16], 0x00, sizeof(sceneRows) - 16);
+	composeTetromino(currentTetromino, currentTetrominoPosition);
+	composeTetromino(nextTetromino, NEXT_TETROMINO_POSITION);
+#else
+#ifdef STATIC_BACKGROUND
+	// restore the background of the areas drawn below
+#ifndef DIRTY_ROWS
+	LcdBar(0,7,64,34);	// playfield (the inner frame without its right border)
+#endif
+	// the preview and the score bar only when they have changed, so that their bytes are not rewritten in every frame
+	if (g_drawnNextTetromino == NO_TETROMINO)
+	{
+		g_drawnScore = ~g_score; // the background has been redrawn, so is the score bar
+	}
+	if (nextTetromino != g_drawnNextTetromino)
+	{
+		LcdBar(76,15,8,13);	// next tetromino
+		canPlaceTetromino(nextTetromino, NEXT_TETROMINO_POSITION, draw);
+		g_drawnNextTetromino = nextTetromino;
+	}
+	if (g_score != g_drawnScore)
+	{
+		LcdBar(2,2,64,2);	// score bar
+		showScore();
+		g_drawnScore = g_score;
+	}
+#else
+	drawBackground();
+#endif
 
+#ifdef DIRTY_ROWS
+	// the rows which have not changed are still in LcdCache
+	composeDirtyRows();
+#else
 	// draw all tiles dropped till now
 	uint8_t * lineAddr = &matrix[15];
 	uint8_t y=16;
@@ -265,85 +1563,205 @@ static void displayScene()
 		--lineAddr;
 	}
 
+#ifdef GHOST_PIECE
+	// draw the landing position first, the tetromino covers it where they overlap
+	canPlaceTetromino(currentTetromino, dropPosition(currentTetromino, currentTetrominoPosition), ghost);
+#endif
+
 	// draw current tile
 	canPlaceTetromino(currentTetromino, currentTetrominoPosition, draw);
+#endif
 
+#ifndef STATIC_BACKGROUND
 	// draw next tetromino
 	canPlaceTetromino(nextTetromino, NEXT_TETROMINO_POSITION, draw);
 
 	showScore();
+#endif
+#endif
+	PROFILE_STOP(PROFILE_COMPOSE);
+#ifdef PROFILER
+	if (g_profilerShown != READOUT_NONE)
+	{
+#ifdef INPUT_LATENCY
+		if (g_profilerShown == READOUT_LATENCY)
+		{
+			latencyShow();
+		}
+		else
+#endif
+		{
+			profilerShow();
+		}
+		profileStart = profilerClock();
+	}
+#endif
 
+	HAL_BENCH_MARK(BENCH_START);
 	LcdUpdate(); // move the content from screen buffer to the LCD driver memory in order to display
+	HAL_BENCH_MARK(BENCH_LCD_UPDATE);
+	PROFILE_STOP(PROFILE_LCD_UPDATE);
+#ifdef INPUT_LATENCY
+	latencyFrameSent();
+#endif
 }
 
+#ifndef ISR_SCHEDULER
 static void delayIfButtonPressed()
 {
 	uint32_t t = 165535; // tuned to get the right timing in button repetition
-	while (--t && (PIND))
+	while (--t && (HAL_BUTTONS()))
 	{
+#if defined(LCD_SPI_INTERRUPT) && defined(LCD_DIRTY_UPDATE)
+		LcdUpdatePoll(); // the frame in flight goes on with its next run
+#endif
 	}
 }
+#endif
 
-int main() 
+// one pass of the game loop: input, gravity and rendering
+static void gameStep()
 {
-	gameInit();
-
-	while (1)
+#ifdef ISR_SCHEDULER
+	takeEvents();
+#endif
+#if defined(INPUT_LATENCY) && !defined(ISR_SCHEDULER)
+	latencyPoll();
+#endif
+#ifdef HARD_DROP
+	if (HARD_DROP_PRESSED)
+	{
+		// one lookup per column instead of a collision check and a frame per row
+		currentTetrominoPosition = dropPosition(currentTetromino, currentTetrominoPosition);
+		moveTetrominoDown(); // stores the tetromino and brings the next one
+		startTimer();
+#ifdef INPUT_LATENCY
+		LATENCY_MOVED(HARD_DROP_BUTTONS);
+#endif
+		goto labelDisplayScene; // left and right make the chord, they do not move the next tetromino
+	}
+#endif
+	if ((TIMER_HAS_EXPIRED) || (DOWN_BUTTON_PRESSED))
 	{
-		if ((TIMER_HAS_EXPIRED) || (DOWN_BUTTON_PRESSED))
+		moveTetrominoDown();
+		startTimer();
+#ifdef INPUT_LATENCY
+		if (DOWN_BUTTON_PRESSED) // not the gravity: the tetromino has moved down or has been stored with the button
 		{
-			moveTetrominoDown();
-			startTimer();
+			LATENCY_MOVED(1<<PD1);
 		}
-		if (ROTATION_BUTTON_PRESSED)
+#endif
+	}
+	PROFILE_START();
+	if (ROTATION_BUTTON_PRESSED)
+	{
+		uint8_t newTetromino;
+		if ((currentTetromino&0x03) == 0x00)
 		{
-			uint8_t newTetromino;
-			if ((currentTetromino&0x03) == 0x00)
-			{
-				newTetromino = currentTetromino | 0x03;
-			} 
-			else
-			{
-				newTetromino = currentTetromino - 1;
-			}
-			if (canPlaceTetromino(newTetromino, currentTetrominoPosition, check))
-			{
-				currentTetromino = newTetromino;
-			}
+			newTetromino = currentTetromino | 0x03;
+		} 
+		else
+		{
+			newTetromino = currentTetromino - 1;
 		}
-		uint8_t newPosition;
-		if (LEFT_BUTTON_PRESSED)
+		if (canPlaceTetromino(newTetromino, currentTetrominoPosition, check))
 		{
-			if ((currentTetrominoPosition&0x07) != 0)
-			{
-				newPosition = currentTetrominoPosition - 1;
-				goto labelNewPosition; // this is not a good practice, but it was needed for optimization
-			}
+			currentTetromino = newTetromino;
+			SCENE_CHANGED();
+#ifdef INPUT_LATENCY
+			LATENCY_MOVED(1<<PD3);
+#endif
 		}
+	}
+	uint8_t newPosition;
+	if (LEFT_BUTTON_PRESSED)
+	{
+		if ((currentTetrominoPosition&0x07) != 0)
+		{
+			newPosition = currentTetrominoPosition - 1;
+			goto labelNewPosition; // this is not a good practice, but it was needed for optimization
+		}
+	}
 
-		if (RIGHT_BUTTON_PRESSED)
+	if (RIGHT_BUTTON_PRESSED)
+	{
+		newPosition = currentTetrominoPosition + 1;
+		if ((newPosition & 0x07) != 0) // if it is 0 it means that currentTetrominoPosition is on the very right end and we can't move to the right anymore
 		{
-			newPosition = currentTetrominoPosition + 1;
-			if ((newPosition & 0x07) != 0) // if it is 0 it means that currentTetrominoPosition is on the very right end and we can't move to the right anymore
-			{
 labelNewPosition:
-				if (canPlaceTetromino(currentTetromino, newPosition, check))
-				{
-					currentTetrominoPosition = newPosition;
-				}
+			if (canPlaceTetromino(currentTetromino, newPosition, check))
+			{
+#ifdef INPUT_LATENCY
+				LATENCY_MOVED((newPosition > currentTetrominoPosition) ? (1<<PD2) : (1<<PD0)); // right or left
+#endif
+				currentTetrominoPosition = newPosition;
+				SCENE_CHANGED();
 			}
 		}
+	}
+	PROFILE_STOP(PROFILE_INPUT);
 
-		if (PIND) // any button is pressed
-		{
-			displayScene();
-			delayIfButtonPressed();
-		}
-		else
+#ifdef HARD_DROP
+labelDisplayScene:
+#endif
+#ifdef INPUT_LATENCY
+	latencyHandled();
+#endif
+#ifdef PROFILER
+	profilerPoll();
+#endif
+#ifdef ISR_SCHEDULER
+	displayScene(); // the button repetition is timed by the tick interrupt
+#else
+	if (HAL_BUTTONS()) // any button is pressed
+	{
+		displayScene();
+		delayIfButtonPressed();
+	}
+	else
+	{
+		displayScene();
+	}
+#endif
+}
+
+#ifdef IDLE_SLEEP
+// sleeps until the main loop has something to do: events of the tick interrupt, or a frame which can be sent.
+// The other interrupts (the ADC of ENTROPY_POOL, the SPI of LCD_SPI_INTERRUPT) wake the CPU for themselves only,
+// or for LCD_UPDATE_POLL() to start the next run of the frame in flight, which is polled on every pass.
+static void idle()
+{
+	HAL_DISABLE_INTERRUPTS();
+	bool busy = LCD_UPDATE_POLL();
+	while ((!g_pendingEvents) && ((!g_sceneChanged) || (busy)))
+	{
+		HAL_SLEEP();
+		HAL_DISABLE_INTERRUPTS();
+#ifdef INPUT_LOG
+		if (g_replaying) // the records are paced by the ticks, not by the pending events
 		{
-			displayScene();
+			break;
 		}
+#endif
+		busy = LCD_UPDATE_POLL();
+	}
+	HAL_ENABLE_INTERRUPTS();
+}
+#endif
+
+#if !defined(TETRIS_NATIVE) && !defined(TETRIS_BENCH) // the host and the benchmark builds call gameInit() and gameStep() themselves
+int main() 
+{
+	gameInit();
+
+	while (1)
+	{
+		gameStep();
+#ifdef IDLE_SLEEP
+		idle();
+#endif
 	}	
 	return 0;
 }
+#endif
 
@@ -21,12 +21,66 @@
  
 /* Global variables */
 
+#ifndef LCD_NO_FRAMEBUFFER
 /* Cache buffer in SRAM 84*48 bits or 504 bytes */
-uint8_t LcdCache [ LCD_CACHE_SIZE ];
+HAL_THREAD_LOCAL uint8_t LcdCache [ LCD_CACHE_SIZE ];
+#endif
 
 /* Cache index */
-#ifndef NDEBUG
-static int   LcdCacheIdx;
+#if !defined(NDEBUG) && !defined(LCD_NO_FRAMEBUFFER)
+static HAL_THREAD_LOCAL int   LcdCacheIdx;
+#endif
+
+#ifdef LCD_DIRTY_UPDATE
+/* One bit per LcdCache byte, set when the byte changes and cleared once it is sent */
+static HAL_THREAD_LOCAL uint8_t LcdDirty [ LCD_CACHE_SIZE / 8 ];
+/* LcdCache range [LcdRunStart, LcdRunEnd) being flushed */
+static HAL_THREAD_LOCAL uint16_t LcdRunStart;
+static HAL_THREAD_LOCAL uint16_t LcdRunEnd;
+/* LcdCache index the LCD controller RAM address points to, LCD_CACHE_SIZE when unknown */
+static HAL_THREAD_LOCAL uint16_t LcdAddress;
+#ifdef LCD_DIRTY_SHADOW
+/* What the LCD controller RAM holds: the bytes sent by the previous flushes */
+static HAL_THREAD_LOCAL uint8_t LcdShadow [ LCD_CACHE_SIZE ];
+#endif
+#endif
+
+#ifdef LCD_STATISTICS
+/* Bytes (data and commands) sent by the last LcdUpdate() */
+HAL_THREAD_LOCAL uint16_t LcdFrameBytes;
+#endif
+
+#ifdef LCD_SPI_INTERRUPT
+/* Frame in flight: LcdCache range [LcdTxIndex, LcdTxEnd) still to be sent by the SPI interrupt */
+static HAL_THREAD_LOCAL volatile uint16_t LcdTxIndex;
+static HAL_THREAD_LOCAL volatile uint16_t LcdTxEnd;
+HAL_THREAD_LOCAL volatile bool LcdTxBusy;
+#ifdef LCD_DIRTY_UPDATE
+/* Set by the SPI interrupt when the run in flight is sent, LcdUpdatePoll() goes on with the next one */
+static HAL_THREAD_LOCAL volatile bool LcdRunSent;
+#endif
+#endif
+
+#ifndef LCD_NO_FRAMEBUFFER
+/*
+ * Name         :  LcdCacheWrite
+ * Description  :  Stores a byte in the cache and marks it dirty if its value changes.
+ * Argument(s)  :  index -> LcdCache index
+ *                 value -> new value of the byte
+ * Return value :  None.
+ */
+static inline void LcdCacheWrite ( uint16_t index, uint8_t value )
+{
+#ifdef LCD_DIRTY_UPDATE
+	if (LcdCache[ index ] != value)
+	{
+		LcdCache[ index ] = value;
+		LcdDirty[ index >> 3 ] |= 0x01 << (index & 0x07);
+	}
+#else
+	LcdCache[ index ] = value;
+#endif
+}
 #endif
 
 /*
@@ -37,22 +91,328 @@ static int   LcdCacheIdx;
  */
 static void LcdInit ( void ) // once static it will be built-in as inline
 {
-    /* Set output bits on LCD Port. */
-    LCD_DDR |= _BV( LCD_RST_PIN ) | _BV( LCD_DC_PIN ) | _BV( LCD_CE_PIN ) | _BV( SPI_MOSI_PIN ) | _BV( SPI_CLK_PIN );
-    /* Toggle display reset pin. */
-    LCD_PORT |= _BV ( LCD_RST_PIN );
+    /* Set output bits on LCD Port and toggle display reset pin. */
+    HAL_LCD_INIT_PINS();
 
+#ifdef LCD_SPI_INTERRUPT
+    // Enable SPI port: MSBit first, Master mode, CPOL->0, CPHA->0, Clk/2
+    // The interrupt is enabled per run by LcdSendBlock(). A byte takes 16 cycles at Clk/2, less than the
+    // interrupt entry and exit, so every interrupt sends LCD_SPI_BURST bytes.
+    HAL_SPI_INIT_CLK2();
+    HAL_ENABLE_INTERRUPTS();
+#else
     // Enable SPI port: No interrupt, MSBit first, Master mode, CPOL->0, CPHA->0, Clk/4
-    SPCR = 0x50;
+    HAL_SPI_INIT();
+#endif
 
 	LCD_SET_COMMANDS_SENDING_MODE;
+#ifdef LCD_VERTICAL_ADDRESSING
+    LcdSend( 0x22 ); /* LCD Standard Commands,Vertical addressing mode */
+#else
     LcdSend( 0x20 ); /* LCD Standard Commands,Horizontal addressing mode */
+#endif
     LcdSend( 0x0C ); /* LCD in normal mode. */
 	LCD_SET_DATA_SENDING_MODE; // from now on only data will be sent to the LCD
+
+#ifdef LCD_DIRTY_UPDATE
+	memset(LcdDirty, 0xFF, sizeof(LcdDirty)); // the LCD RAM content is undefined after reset
+	LcdAddress = LCD_CACHE_SIZE;
+#ifdef LCD_DIRTY_SHADOW
+	uint16_t index;
+	for (index = 0; index < LCD_CACHE_SIZE; ++index)
+	{
+		LcdShadow[ index ] = ~LcdCache[ index ]; // no byte matches, so the first flush sends all of them
+	}
+#endif
+#endif
+}
+
+#ifdef LCD_DIRTY_UPDATE
+/*
+ * Name         :  LcdNextRun
+ * Description  :  Finds the next run of dirty bytes behind the current one. Clean
+ *                 gaps not longer than LCD_RUN_MERGE_GAP are sent as a part of the run.
+ * Argument(s)  :  None.
+ * Return value :  FALSE if there is no more dirty bytes, LcdRunStart/LcdRunEnd are set otherwise.
+ */
+static bool LcdNextRun ( void )
+{
+	uint16_t index = LcdRunEnd;
+	while (TRUE)
+	{
+		if (index >= LCD_CACHE_SIZE)
+		{
+			return FALSE;
+		}
+		uint8_t dirty = LcdDirty[ index >> 3 ] >> (index & 0x07);
+		if (dirty & 0x01)
+		{
+			break;
+		}
+		if (dirty) // there is a dirty byte further in this group of 8
+		{
+			++index;
+		}
+		else
+		{
+			index = (index | 0x07) + 1;
+		}
+	}
+	LcdRunStart = index;
+	LcdRunEnd = ++index;
+	uint8_t gap = 0;
+	while ((index < LCD_CACHE_SIZE) && (gap <= LCD_RUN_MERGE_GAP))
+	{
+		if (LcdDirty[ index >> 3 ] & (0x01 << (index & 0x07)))
+		{
+			LcdRunEnd = index + 1;
+			gap = 0;
+		}
+		else
+		{
+			++gap;
+		}
+		++index;
+	}
+	return TRUE;
+}
+
+/*
+ * Name         :  LcdGotoRun
+ * Description  :  Sets the LCD controller RAM address to LcdRunStart unless it points there already,
+ *                 e.g. behind the previous run or at 0 after a flush of the whole cache.
+ *                 LcdAddress is moved behind the run, which is expected to be sent next.
+ * Argument(s)  :  None.
+ * Return value :  None.
+ */
+static void LcdGotoRun ( void )
+{
+	uint16_t index = LcdRunStart;
+	if (index == LcdAddress)
+	{
+		LcdAddress = (LcdRunEnd < LCD_CACHE_SIZE) ? LcdRunEnd : 0; // the address wraps after the last byte
+		return;
+	}
+	LcdAddress = (LcdRunEnd < LCD_CACHE_SIZE) ? LcdRunEnd : 0;
+	uint8_t bank = 0;
+	while (index >= LCD_X_RES)
+	{
+		index -= LCD_X_RES;
+		++bank;
+	}
+	LCD_SET_COMMANDS_SENDING_MODE;
+	LcdSend( 0x80 | index ); /* set X address */
+	LcdSend( 0x40 | bank );  /* set Y address */
+	LCD_SET_DATA_SENDING_MODE;
+}
+#endif
+
+#if defined(LCD_DIRTY_UPDATE) || defined(LCD_SPI_INTERRUPT)
+/*
+ * Name         :  LcdSendBlock
+ * Description  :  Sends LcdCache bytes [start, end) as data. With LCD_SPI_INTERRUPT it only sends
+ *                 the first byte and the rest is sent in the background by the SPI interrupt.
+ * Argument(s)  :  start -> index of the first byte
+ *                 end   -> index behind the last byte
+ * Return value :  None.
+ */
+static void LcdSendBlock ( uint16_t start, uint16_t end )
+{
+#ifdef LCD_SPI_INTERRUPT
+	LcdTxIndex = start + 1;
+	LcdTxEnd = end;
+	LcdTxBusy = TRUE;
+	HAL_SPI_CLEAR_FLAG();
+	HAL_SPI_WRITE( LcdCache[ start ] );
+#ifdef LCD_STATISTICS
+	++LcdFrameBytes;
+#endif
+	HAL_SPI_INTERRUPT_ENABLE();
+#else
+	while (start < end)
+	{
+		LcdSend( LcdCache[ start ] );
+		++start;
+	}
+#endif
+}
+#endif
+
+#ifdef LCD_SPI_INTERRUPT
+/*
+ * Name         :  SPI transfer complete interrupt
+ * Description  :  Sends the next LCD_SPI_BURST bytes of the run in flight. It waits for every transfer but the
+ *                 last one, which raises the next interrupt. Once the run is sent the interrupt disables itself;
+ *                 with LCD_DIRTY_UPDATE the next run is started by LcdUpdatePoll() in the main loop.
+ */
+HAL_ISR( HAL_SPI_VECTOR )
+{
+	HAL_BENCH_MARK(BENCH_FLUSH_BEGIN);
+	uint16_t index = LcdTxIndex;
+	uint16_t end = LcdTxEnd;
+	if (index == end)
+	{
+		HAL_SPI_INTERRUPT_DISABLE();
+#ifdef LCD_DIRTY_UPDATE
+		LcdRunSent = TRUE;
+#else
+		LcdTxBusy = FALSE;
+#endif
+	}
+	else
+	{
+		if (end - index > LCD_SPI_BURST)
+		{
+			end = index + LCD_SPI_BURST;
+		}
+		HAL_SPI_WRITE( LcdCache[ index ] ); // the interrupt has cleared SPIF
+		while (++index != end)
+		{
+			HAL_SPI_WAIT();
+			HAL_SPI_WRITE( LcdCache[ index ] );
+		}
+#ifdef LCD_STATISTICS
+		LcdFrameBytes += end - LcdTxIndex;
+#endif
+		LcdTxIndex = end;
+	}
+	HAL_BENCH_MARK(BENCH_FLUSH_END);
+}
+
+#ifdef LCD_DIRTY_UPDATE
+/*
+ * Name         :  LcdUpdatePoll
+ * Description  :  Goes on with the frame in flight from the main loop: once the SPI interrupt has sent a run,
+ *                 sets the address of the next one and starts it, or ends the frame. The address commands
+ *                 are busy-waited here, not in the interrupt.
+ * Argument(s)  :  None.
+ * Return value :  LCD_UPDATE_IN_PROGRESS
+ */
+static bool LcdUpdatePoll ( void )
+{
+	if (LcdRunSent)
+	{
+		HAL_BENCH_MARK(BENCH_FLUSH_BEGIN);
+		LcdRunSent = FALSE;
+		if (LcdNextRun())
+		{
+			LcdGotoRun();
+			LcdSendBlock( LcdRunStart, LcdRunEnd );
+		}
+		else
+		{
+			memset(LcdDirty, 0x00, sizeof(LcdDirty));
+			LcdTxBusy = FALSE;
+		}
+		HAL_BENCH_MARK(BENCH_FLUSH_END);
+	}
+	return LcdTxBusy;
 }
+#endif
+#endif
 
+/*
+ * Name         :  LcdWaitForUpdate
+ * Description  :  Waits until the frame in flight is sent, so the cache can be modified.
+ * Argument(s)  :  None.
+ * Return value :  None.
+ */
+static inline void LcdWaitForUpdate ( void )
+{
+	while (LCD_UPDATE_POLL())
+	{
+	}
+}
+
+/*
+ * Name         :  LcdUpdate
+ * Description  :  Copies the cache to the LCD controller memory. With LCD_DIRTY_UPDATE only the bytes
+ *                 changed since the last update are sent unless there is more than LCD_FULL_FLUSH_THRESHOLD of them.
+ *                 With LCD_SPI_INTERRUPT it returns as soon as the transmission is started.
+ *                 With LCD_NO_FRAMEBUFFER every byte is composed by LcdComposeByte() just before it is sent.
+ * Argument(s)  :  None.
+ * Return value :  None.
+ */
 static void LcdUpdate ( void )
 {
+	LcdWaitForUpdate();
+	HAL_BENCH_MARK(BENCH_FLUSH_FRAME);
+#ifdef LCD_STATISTICS
+	LcdFrameBytes = 0;
+#endif
+#if defined(LCD_NO_FRAMEBUFFER) && defined(LCD_VERTICAL_ADDRESSING)
+	uint8_t x;
+	for (x = 0; x < LCD_X_RES; ++x)
+	{
+		uint8_t bank;
+		for (bank = 0; bank < LCD_Y_RES / 8; ++bank)
+		{
+			LcdSend( LcdComposeByte( x, bank ) );
+		}
+	}
+#elif defined(LCD_NO_FRAMEBUFFER)
+	uint8_t bank;
+	for (bank = 0; bank < LCD_Y_RES / 8; ++bank)
+	{
+		uint8_t x;
+		for (x = 0; x < LCD_X_RES; ++x)
+		{
+			LcdSend( LcdComposeByte( x, bank ) );
+		}
+	}
+#elif defined(LCD_DIRTY_UPDATE)
+	uint16_t dirtyBytes = 0;
+	uint8_t i;
+	for (i = 0; i < sizeof(LcdDirty); ++i)
+	{
+		uint8_t bits = LcdDirty[ i ];
+#ifdef LCD_DIRTY_SHADOW
+		// a byte changed and changed back, e.g. cleared and redrawn, is not sent
+		uint16_t index = i * 8;
+		uint8_t bit;
+		for (bit = 0x01; bit; bit <<= 1, ++index)
+		{
+			if (bits & bit)
+			{
+				if (LcdCache[ index ] == LcdShadow[ index ])
+				{
+					bits &= ~bit;
+				}
+				else
+				{
+					LcdShadow[ index ] = LcdCache[ index ];
+				}
+			}
+		}
+		LcdDirty[ i ] = bits;
+#endif
+		while (bits)
+		{
+			bits &= bits - 1;
+			++dirtyBytes;
+		}
+	}
+	if (dirtyBytes >= LCD_FULL_FLUSH_THRESHOLD)
+	{
+		memset(LcdDirty, 0xFF, sizeof(LcdDirty)); // a single run covering the whole cache
+	}
+
+	LcdRunEnd = 0;
+#ifdef LCD_SPI_INTERRUPT
+	LcdTxBusy = TRUE;
+	LcdRunSent = TRUE; // there is no run in flight, LcdUpdatePoll() starts the first one
+	LcdUpdatePoll();
+#else
+	while (LcdNextRun())
+	{
+		LcdGotoRun();
+		LcdSendBlock( LcdRunStart, LcdRunEnd );
+	}
+	memset(LcdDirty, 0x00, sizeof(LcdDirty));
+#endif
+#elif defined(LCD_SPI_INTERRUPT)
+	LcdSendBlock( 0, LCD_CACHE_SIZE );
+#else
 	uint8_t *byteToSend = LcdCache;
 	uint16_t i = 504;
 	while (i)
@@ -61,6 +421,29 @@ static void LcdUpdate ( void )
 		--i;
 		byteToSend++;
 	}
+#endif
+	HAL_BENCH_MARK(BENCH_FLUSH_END);
+}
+
+#ifndef LCD_NO_FRAMEBUFFER
+/*
+ * Name         :  LcdClear
+ * Description  :  Clears the cache.
+ * Argument(s)  :  None.
+ * Return value :  None.
+ */
+static void LcdClear ( void )
+{
+#ifdef LCD_DIRTY_UPDATE
+	uint16_t index = LCD_CACHE_SIZE;
+	while (index)
+	{
+		--index;
+		LcdCacheWrite( index, 0x00 );
+	}
+#else
+	memset(LcdCache, 0x00, LCD_CACHE_SIZE);
+#endif
 }
 
 /*
@@ -80,6 +463,49 @@ static void LcdBar ( uint8_t baseX, uint8_t baseY, uint8_t width, uint8_t height
 
 	bool mode = TRUE; // draw black pixels
 	if (baseY&0x01) mode = FALSE; // draw blank pixels
+#ifdef LCD_SPAN_BAR
+	if ((!width) || (!height))
+	{
+		return;
+	}
+	// every bank is filled with one byte mask per column: partial masks for the top and the bottom bank, 0xFF in between
+	uint8_t lastY = baseY + height - 1;
+	uint8_t bank = baseY >> 3;
+	uint8_t lastBank = lastY >> 3;
+	uint8_t bankMask = 0xFF << (baseY & 0x07);
+	uint16_t rowIndex = LCD_CACHE_INDEX( baseX, bank );
+	while (TRUE)
+	{
+		if (bank == lastBank)
+		{
+			bankMask &= 0xFF >> (7 - (lastY & 0x07));
+		}
+		uint16_t index = rowIndex;
+		uint8_t xCounter = width;
+		while (xCounter)
+		{
+			uint8_t value = LcdCache[ index ];
+			if (mode)
+			{
+				value |= bankMask;
+			}
+			else
+			{
+				value &= ( ~bankMask);
+			}
+			LcdCacheWrite( index, value );
+			index += LCD_CACHE_X_STEP;
+			--xCounter;
+		}
+		if (bank == lastBank)
+		{
+			break;
+		}
+		++bank;
+		rowIndex += LCD_CACHE_BANK_STEP;
+		bankMask = 0xFF;
+	}
+#else
 	while (height)
 	{
 		uint8_t x = baseX;
@@ -94,10 +520,9 @@ static void LcdBar ( uint8_t baseX, uint8_t baseY, uint8_t width, uint8_t height
 				assert( x < LCD_X_RES );
 				assert( baseY < LCD_Y_RES );
 
-				index = ( ( baseY >> 3 ) * 84 ) + x;
+				index = LCD_CACHE_INDEX( x, baseY >> 3 );
 				bitMask = 0x01 << (baseY & 0x07);
-				uint8_t *addr = &LcdCache[ index ];
-				uint8_t value = *addr; // splitting LcdCache[ index ] |= bitMask;  it helps the compiler to optimize (we saved 2B)
+				uint8_t value = LcdCache[ index ]; // splitting LcdCache[ index ] |= bitMask;  it helps the compiler to optimize (we saved 2B)
 				if (mode)
 				{
 					value |= bitMask;
@@ -106,7 +531,7 @@ static void LcdBar ( uint8_t baseX, uint8_t baseY, uint8_t width, uint8_t height
 				{
 					value &= ( ~bitMask);
 				}
-				*addr = value;			
+				LcdCacheWrite( index, value );
 			}
 			++x;
 			--xCounter;
@@ -114,7 +539,9 @@ static void LcdBar ( uint8_t baseX, uint8_t baseY, uint8_t width, uint8_t height
 		++baseY;
 		--height;
 	}
+#endif
 }
+#endif // LCD_NO_FRAMEBUFFER
 
 /*
  * Name         :  LcdSend
@@ -126,14 +553,18 @@ static void LcdBar ( uint8_t baseX, uint8_t baseY, uint8_t width, uint8_t height
 static void LcdSend ( uint8_t data )
 {
 	 // Send data and wait for the Tx register
-	 SPDR = data;
-	 while ( !(SPSR & 0x80) );
+	 HAL_SPI_WRITE( data );
+#ifdef LCD_STATISTICS
+	 ++LcdFrameBytes;
+#endif
+	 HAL_SPI_WAIT();
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // supporting functions; not used in "release"
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #ifndef NDEBUG
+#ifndef LCD_NO_FRAMEBUFFER
 /*
  * Name         :  LcdGotoXYFont
  * Description  :  Sets cursor location to xy location corresponding to basic
@@ -156,6 +587,22 @@ static uint8_t LcdGotoXYFont ( uint8_t x, uint8_t y )
     return OK;
 }
 
+/*
+ * Name         :  LcdCursorIndex
+ * Description  :  Converts a cursor index, which counts in the horizontal addressing order
+ *                 like LcdGotoXYFont() does, to the LcdCache index.
+ * Argument(s)  :  cursor -> cursor index
+ * Return value :  LcdCache index.
+ */
+static inline uint16_t LcdCursorIndex ( int cursor )
+{
+#ifdef LCD_VERTICAL_ADDRESSING
+    return LCD_CACHE_INDEX( cursor % LCD_X_RES, cursor / LCD_X_RES );
+#else
+    return cursor;
+#endif
+}
+
 /*
  * Name         :  LcdChr
  * Description  :  Displays a character at current cursor location and
@@ -181,7 +628,7 @@ static uint8_t LcdChr ( LcdFontSize size, uint8_t ch )
         for ( i = 0; i < 5; i++ )
         {
             /* Copy lookup table from Flash ROM to LcdCache */
-            LcdCache[LcdCacheIdx++] = pgm_read_byte(&( FontLookup[ ch - 32 ][ i ] ) ) << 1;
+            LcdCacheWrite( LcdCursorIndex( LcdCacheIdx++ ), pgm_read_byte(&( FontLookup[ ch - 32 ][ i ] ) ) << 1 );
         }
     }
     else if ( size == FONT_2X )
@@ -209,10 +656,10 @@ static uint8_t LcdChr ( LcdFontSize size, uint8_t ch )
             b2 |= (c & 0x08) * 24;
 
             /* Copy two parts into LcdCache */
-            LcdCache[tmpIdx++] = b1;
-            LcdCache[tmpIdx++] = b1;
-            LcdCache[tmpIdx + 82] = b2;
-            LcdCache[tmpIdx + 83] = b2;
+            LcdCacheWrite( LcdCursorIndex( tmpIdx++ ), b1 );
+            LcdCacheWrite( LcdCursorIndex( tmpIdx++ ), b1 );
+            LcdCacheWrite( LcdCursorIndex( tmpIdx + 82 ), b2 );
+            LcdCacheWrite( LcdCursorIndex( tmpIdx + 83 ), b2 );
         }
 
         /* Update x cursor position. */
@@ -222,7 +669,7 @@ static uint8_t LcdChr ( LcdFontSize size, uint8_t ch )
 
     /* Horizontal gap between characters. */
     /* Version 0.2.5 - Possible bug fixed on Dec 25,2008 */
-    LcdCache[LcdCacheIdx] = 0x00;
+    LcdCacheWrite( LcdCursorIndex( LcdCacheIdx ), 0x00 );
     /* At index number LCD_CACHE_SIZE - 1, wrap to 0 */
     if(LcdCacheIdx == (LCD_CACHE_SIZE - 1) )
     {
@@ -289,8 +736,13 @@ static uint8_t LcdFStr ( LcdFontSize size, const uint8_t *dataPtr )
     return OK;
 }
 
+#endif // LCD_NO_FRAMEBUFFER
+
 void __assert(const char *__file, int __lineno)
 {
+	HAL_ASSERT_FAILED(__file, __lineno);
+#ifndef LCD_NO_FRAMEBUFFER // there is no cache for the text otherwise
+	LcdWaitForUpdate();
 	LcdGotoXYFont(1,1);
 	LcdFStr(FONT_1X,(unsigned char*)PSTR("Assert:"));
 	LcdGotoXYFont(1,2);
@@ -300,7 +752,8 @@ void __assert(const char *__file, int __lineno)
 	itoa(__lineno, str+5, 10);
 	LcdStr(FONT_1X,(unsigned char*)(str));
 	LcdUpdate();
-	while (1){}
+#endif
+	HAL_HALT();
 }
 
 #endif // NDEBUG
\ No newline at end of file
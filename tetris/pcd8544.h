@@ -47,26 +47,70 @@
 #define BAR_X                      5
 #define BAR_Y                      38
 
-/* LCD Port */
-#define LCD_PORT                   PORTB
-#define LCD_DDR                    DDRB
+/* Driver options (all of them are disabled in the 1KB contest build) */
+//#define LCD_DIRTY_UPDATE                 /* LcdUpdate() sends only the bytes changed since the last flush (needs DIRTY_ROWS of main.c or LCD_DIRTY_SHADOW) */
+//#define LCD_DIRTY_SHADOW                 /* LCD_DIRTY_UPDATE does not send the changed bytes that are back to their last sent value */
+//#define LCD_STATISTICS                   /* count the bytes sent over SPI by every LcdUpdate() */
+//#define LCD_SPI_INTERRUPT                /* LcdUpdate() sends the frame in the background from the SPI interrupt */
+//#define LCD_SPAN_BAR                     /* LcdBar() fills whole bytes of every bank instead of single pixels */
+//#define LCD_NO_FRAMEBUFFER               /* no LcdCache, LcdUpdate() gets every byte from LcdComposeByte() */
+//#define LCD_VERTICAL_ADDRESSING          /* the controller and LcdCache run down the banks of a column, then to the next column */
+
+#ifndef LCD_FULL_FLUSH_THRESHOLD
+#define LCD_FULL_FLUSH_THRESHOLD   400   /* number of dirty bytes from which the whole cache is sent */
+#endif
+#define LCD_RUN_MERGE_GAP          2     /* clean bytes bridged between two runs (cheaper than a new address) */
+#define LCD_SPI_BURST              8     /* bytes sent by one SPI interrupt (LCD_SPI_INTERRUPT) */
 
-typedef uint8_t bool;
+/* LCD Port and pinout: see hal.h */
 
-/* ATMega8 port pinout for LCD. */
-/* 0.2.6 bug, fixed */
-#define LCD_DC_PIN                 PB0  /* Pin 0 */
-#define LCD_CE_PIN                 PB2  /* Pin 2 */
-#define SPI_MOSI_PIN               PB3  /* Pin 3 */
-#define LCD_RST_PIN                PB4  /* Pin 4 */
-#define SPI_CLK_PIN                PB5  /* Pin 5 */
+typedef uint8_t bool;
 
 /* Cache size in bytes ( 84 * 48 ) / 8 = 504 bytes */
 #define LCD_CACHE_SIZE             ( ( LCD_X_RES * LCD_Y_RES ) / 8)
-extern uint8_t LcdCache [ LCD_CACHE_SIZE ];
 
-#define LCD_SET_DATA_SENDING_MODE (LCD_PORT |= _BV( LCD_DC_PIN ))
-#define LCD_SET_COMMANDS_SENDING_MODE (LCD_PORT &= ~( _BV( LCD_DC_PIN ) ))
+/* Layout of LcdCache, the order in which the controller auto-increments its RAM address */
+#ifdef LCD_VERTICAL_ADDRESSING
+#define LCD_CACHE_X_STEP           ( LCD_Y_RES / 8 )   /* column-major: the 6 banks of a column are consecutive */
+#define LCD_CACHE_BANK_STEP        1
+#else
+#define LCD_CACHE_X_STEP           1                   /* bank-major: the 84 columns of a bank are consecutive */
+#define LCD_CACHE_BANK_STEP        LCD_X_RES
+#endif
+#define LCD_CACHE_INDEX(x, bank)   ( ( (bank) * LCD_CACHE_BANK_STEP ) + ( (x) * LCD_CACHE_X_STEP ) )
+#if defined(LCD_DIRTY_SHADOW) && !defined(LCD_DIRTY_UPDATE)
+#error "LCD_DIRTY_SHADOW needs LCD_DIRTY_UPDATE"
+#endif
+#if defined(LCD_VERTICAL_ADDRESSING) && defined(LCD_DIRTY_UPDATE)
+#error "LCD_VERTICAL_ADDRESSING splits a changed tile into 4 runs of LCD_DIRTY_UPDATE, use the horizontal layout"
+#endif
+#ifdef LCD_NO_FRAMEBUFFER
+#if defined(LCD_DIRTY_UPDATE) || defined(LCD_SPI_INTERRUPT)
+#error "LCD_NO_FRAMEBUFFER cannot be combined with LCD_DIRTY_UPDATE or LCD_SPI_INTERRUPT"
+#endif
+#else
+extern HAL_THREAD_LOCAL uint8_t LcdCache [ LCD_CACHE_SIZE ];
+#endif
+
+#ifdef LCD_STATISTICS
+extern HAL_THREAD_LOCAL uint16_t LcdFrameBytes;
+#endif
+
+#ifdef LCD_SPI_INTERRUPT
+extern HAL_THREAD_LOCAL volatile bool LcdTxBusy;
+#define LCD_UPDATE_IN_PROGRESS     (LcdTxBusy)   /* LcdCache must not be modified while TRUE */
+#ifdef LCD_DIRTY_UPDATE
+#define LCD_UPDATE_POLL()          (LcdUpdatePoll())   /* the same for the main loop, which starts the next run of the frame */
+#else
+#define LCD_UPDATE_POLL()          (LcdTxBusy)
+#endif
+#else
+#define LCD_UPDATE_IN_PROGRESS     (FALSE)
+#define LCD_UPDATE_POLL()          (FALSE)
+#endif
+
+#define LCD_SET_DATA_SENDING_MODE HAL_LCD_DATA_MODE()
+#define LCD_SET_COMMANDS_SENDING_MODE HAL_LCD_COMMAND_MODE()
 
 typedef enum
 {
@@ -83,11 +127,17 @@ typedef enum
 } LcdFontSize;
 
 /* Function prototypes */
+#ifdef LCD_NO_FRAMEBUFFER
+/* Implemented by the application: returns the byte of column x in the given bank (8 pixel rows) */
+static uint8_t LcdComposeByte ( uint8_t x, uint8_t bank );
+#else
 #ifndef NDEBUG
 static uint8_t LcdGotoXYFont ( uint8_t x, uint8_t y );
 static uint8_t LcdStr        ( LcdFontSize size, uint8_t dataArray[] );
 #endif
 static void LcdBar          ( uint8_t baseX, uint8_t baseY, uint8_t height, uint8_t width);
+static void LcdClear        ( void );
+#endif
 static void LcdSend ( uint8_t data );
 
 
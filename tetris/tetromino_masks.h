@@ -0,0 +1,159 @@
+/*
+ * tetromino_masks.h
+ *
+ * Collision tables used by canPlaceTetromino() when COLLISION_TABLES is defined.
+ * Generated from tetrominos[] in main.c; regenerate them whenever a tetromino specification changes.
+ */
+
+
+#ifndef TETROMINO_MASKS_H_
+#define TETROMINO_MASKS_H_
+
+// blocks of the 3 rows of every tetromino orientation placed in each of the 8 columns,
+// with the same bit order as "matrix" (0x80 is column 0); blocks beyond column 7 are cut off
+static const uint8_t tetrominoRowMasks[8*4][8][3] PROGMEM =
+{
+	{ // I 0 (0xE0)
+		{ 0xE0, 0x00, 0x00 }, { 0x70, 0x00, 0x00 }, { 0x38, 0x00, 0x00 }, { 0x1C, 0x00, 0x00 },
+		{ 0x0E, 0x00, 0x00 }, { 0x07, 0x00, 0x00 }, { 0x03, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // I 90 (0x92)
+		{ 0x80, 0x80, 0x80 }, { 0x40, 0x40, 0x40 }, { 0x20, 0x20, 0x20 }, { 0x10, 0x10, 0x10 },
+		{ 0x08, 0x08, 0x08 }, { 0x04, 0x04, 0x04 }, { 0x02, 0x02, 0x02 }, { 0x01, 0x01, 0x01 }
+	},
+	{ // I 180 (0xE0)
+		{ 0xE0, 0x00, 0x00 }, { 0x70, 0x00, 0x00 }, { 0x38, 0x00, 0x00 }, { 0x1C, 0x00, 0x00 },
+		{ 0x0E, 0x00, 0x00 }, { 0x07, 0x00, 0x00 }, { 0x03, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // I 270 (0x92)
+		{ 0x80, 0x80, 0x80 }, { 0x40, 0x40, 0x40 }, { 0x20, 0x20, 0x20 }, { 0x10, 0x10, 0x10 },
+		{ 0x08, 0x08, 0x08 }, { 0x04, 0x04, 0x04 }, { 0x02, 0x02, 0x02 }, { 0x01, 0x01, 0x01 }
+	},
+	{ // J 0 (0xE4)
+		{ 0xE0, 0x20, 0x00 }, { 0x70, 0x10, 0x00 }, { 0x38, 0x08, 0x00 }, { 0x1C, 0x04, 0x00 },
+		{ 0x0E, 0x02, 0x00 }, { 0x07, 0x01, 0x00 }, { 0x03, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // J 90 (0xD2)
+		{ 0xC0, 0x80, 0x80 }, { 0x60, 0x40, 0x40 }, { 0x30, 0x20, 0x20 }, { 0x18, 0x10, 0x10 },
+		{ 0x0C, 0x08, 0x08 }, { 0x06, 0x04, 0x04 }, { 0x03, 0x02, 0x02 }, { 0x01, 0x01, 0x01 }
+	},
+	{ // J 180 (0x9C)
+		{ 0x80, 0xE0, 0x00 }, { 0x40, 0x70, 0x00 }, { 0x20, 0x38, 0x00 }, { 0x10, 0x1C, 0x00 },
+		{ 0x08, 0x0E, 0x00 }, { 0x04, 0x07, 0x00 }, { 0x02, 0x03, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // J 270 (0x4B)
+		{ 0x40, 0x40, 0xC0 }, { 0x20, 0x20, 0x60 }, { 0x10, 0x10, 0x30 }, { 0x08, 0x08, 0x18 },
+		{ 0x04, 0x04, 0x0C }, { 0x02, 0x02, 0x06 }, { 0x01, 0x01, 0x03 }, { 0x00, 0x00, 0x01 }
+	},
+	{ // L 0 (0xF0)
+		{ 0xE0, 0x80, 0x00 }, { 0x70, 0x40, 0x00 }, { 0x38, 0x20, 0x00 }, { 0x1C, 0x10, 0x00 },
+		{ 0x0E, 0x08, 0x00 }, { 0x07, 0x04, 0x00 }, { 0x03, 0x02, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // L 90 (0x93)
+		{ 0x80, 0x80, 0xC0 }, { 0x40, 0x40, 0x60 }, { 0x20, 0x20, 0x30 }, { 0x10, 0x10, 0x18 },
+		{ 0x08, 0x08, 0x0C }, { 0x04, 0x04, 0x06 }, { 0x02, 0x02, 0x03 }, { 0x01, 0x01, 0x01 }
+	},
+	{ // L 180 (0x3C)
+		{ 0x20, 0xE0, 0x00 }, { 0x10, 0x70, 0x00 }, { 0x08, 0x38, 0x00 }, { 0x04, 0x1C, 0x00 },
+		{ 0x02, 0x0E, 0x00 }, { 0x01, 0x07, 0x00 }, { 0x00, 0x03, 0x00 }, { 0x00, 0x01, 0x00 }
+	},
+	{ // L 270 (0xC9)
+		{ 0xC0, 0x40, 0x40 }, { 0x60, 0x20, 0x20 }, { 0x30, 0x10, 0x10 }, { 0x18, 0x08, 0x08 },
+		{ 0x0C, 0x04, 0x04 }, { 0x06, 0x02, 0x02 }, { 0x03, 0x01, 0x01 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // o 0 (0xD8)
+		{ 0xC0, 0xC0, 0x00 }, { 0x60, 0x60, 0x00 }, { 0x30, 0x30, 0x00 }, { 0x18, 0x18, 0x00 },
+		{ 0x0C, 0x0C, 0x00 }, { 0x06, 0x06, 0x00 }, { 0x03, 0x03, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // o 90 (0xD8)
+		{ 0xC0, 0xC0, 0x00 }, { 0x60, 0x60, 0x00 }, { 0x30, 0x30, 0x00 }, { 0x18, 0x18, 0x00 },
+		{ 0x0C, 0x0C, 0x00 }, { 0x06, 0x06, 0x00 }, { 0x03, 0x03, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // o 180 (0xD8)
+		{ 0xC0, 0xC0, 0x00 }, { 0x60, 0x60, 0x00 }, { 0x30, 0x30, 0x00 }, { 0x18, 0x18, 0x00 },
+		{ 0x0C, 0x0C, 0x00 }, { 0x06, 0x06, 0x00 }, { 0x03, 0x03, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // o 270 (0xD8)
+		{ 0xC0, 0xC0, 0x00 }, { 0x60, 0x60, 0x00 }, { 0x30, 0x30, 0x00 }, { 0x18, 0x18, 0x00 },
+		{ 0x0C, 0x0C, 0x00 }, { 0x06, 0x06, 0x00 }, { 0x03, 0x03, 0x00 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // S 0 (0x78)
+		{ 0x60, 0xC0, 0x00 }, { 0x30, 0x60, 0x00 }, { 0x18, 0x30, 0x00 }, { 0x0C, 0x18, 0x00 },
+		{ 0x06, 0x0C, 0x00 }, { 0x03, 0x06, 0x00 }, { 0x01, 0x03, 0x00 }, { 0x00, 0x01, 0x00 }
+	},
+	{ // S 90 (0x99)
+		{ 0x80, 0xC0, 0x40 }, { 0x40, 0x60, 0x20 }, { 0x20, 0x30, 0x10 }, { 0x10, 0x18, 0x08 },
+		{ 0x08, 0x0C, 0x04 }, { 0x04, 0x06, 0x02 }, { 0x02, 0x03, 0x01 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // S 180 (0x78)
+		{ 0x60, 0xC0, 0x00 }, { 0x30, 0x60, 0x00 }, { 0x18, 0x30, 0x00 }, { 0x0C, 0x18, 0x00 },
+		{ 0x06, 0x0C, 0x00 }, { 0x03, 0x06, 0x00 }, { 0x01, 0x03, 0x00 }, { 0x00, 0x01, 0x00 }
+	},
+	{ // S 270 (0x99)
+		{ 0x80, 0xC0, 0x40 }, { 0x40, 0x60, 0x20 }, { 0x20, 0x30, 0x10 }, { 0x10, 0x18, 0x08 },
+		{ 0x08, 0x0C, 0x04 }, { 0x04, 0x06, 0x02 }, { 0x02, 0x03, 0x01 }, { 0x01, 0x01, 0x00 }
+	},
+	{ // T 0 (0xE8)
+		{ 0xE0, 0x40, 0x00 }, { 0x70, 0x20, 0x00 }, { 0x38, 0x10, 0x00 }, { 0x1C, 0x08, 0x00 },
+		{ 0x0E, 0x04, 0x00 }, { 0x07, 0x02, 0x00 }, { 0x03, 0x01, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // T 90 (0x9A)
+		{ 0x80, 0xC0, 0x80 }, { 0x40, 0x60, 0x40 }, { 0x20, 0x30, 0x20 }, { 0x10, 0x18, 0x10 },
+		{ 0x08, 0x0C, 0x08 }, { 0x04, 0x06, 0x04 }, { 0x02, 0x03, 0x02 }, { 0x01, 0x01, 0x01 }
+	},
+	{ // T 180 (0x5C)
+		{ 0x40, 0xE0, 0x00 }, { 0x20, 0x70, 0x00 }, { 0x10, 0x38, 0x00 }, { 0x08, 0x1C, 0x00 },
+		{ 0x04, 0x0E, 0x00 }, { 0x02, 0x07, 0x00 }, { 0x01, 0x03, 0x00 }, { 0x00, 0x01, 0x00 }
+	},
+	{ // T 270 (0x59)
+		{ 0x40, 0xC0, 0x40 }, { 0x20, 0x60, 0x20 }, { 0x10, 0x30, 0x10 }, { 0x08, 0x18, 0x08 },
+		{ 0x04, 0x0C, 0x04 }, { 0x02, 0x06, 0x02 }, { 0x01, 0x03, 0x01 }, { 0x00, 0x01, 0x00 }
+	},
+	{ // Z 0 (0xCC)
+		{ 0xC0, 0x60, 0x00 }, { 0x60, 0x30, 0x00 }, { 0x30, 0x18, 0x00 }, { 0x18, 0x0C, 0x00 },
+		{ 0x0C, 0x06, 0x00 }, { 0x06, 0x03, 0x00 }, { 0x03, 0x01, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // Z 90 (0x5A)
+		{ 0x40, 0xC0, 0x80 }, { 0x20, 0x60, 0x40 }, { 0x10, 0x30, 0x20 }, { 0x08, 0x18, 0x10 },
+		{ 0x04, 0x0C, 0x08 }, { 0x02, 0x06, 0x04 }, { 0x01, 0x03, 0x02 }, { 0x00, 0x01, 0x01 }
+	},
+	{ // Z 180 (0xCC)
+		{ 0xC0, 0x60, 0x00 }, { 0x60, 0x30, 0x00 }, { 0x30, 0x18, 0x00 }, { 0x18, 0x0C, 0x00 },
+		{ 0x0C, 0x06, 0x00 }, { 0x06, 0x03, 0x00 }, { 0x03, 0x01, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // Z 270 (0x5A)
+		{ 0x40, 0xC0, 0x80 }, { 0x20, 0x60, 0x40 }, { 0x10, 0x30, 0x20 }, { 0x08, 0x18, 0x10 },
+		{ 0x04, 0x0C, 0x08 }, { 0x02, 0x06, 0x04 }, { 0x01, 0x03, 0x02 }, { 0x00, 0x01, 0x01 }
+	},
+	{ // . 0 (0x80)
+		{ 0x80, 0x00, 0x00 }, { 0x40, 0x00, 0x00 }, { 0x20, 0x00, 0x00 }, { 0x10, 0x00, 0x00 },
+		{ 0x08, 0x00, 0x00 }, { 0x04, 0x00, 0x00 }, { 0x02, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // . 90 (0x80)
+		{ 0x80, 0x00, 0x00 }, { 0x40, 0x00, 0x00 }, { 0x20, 0x00, 0x00 }, { 0x10, 0x00, 0x00 },
+		{ 0x08, 0x00, 0x00 }, { 0x04, 0x00, 0x00 }, { 0x02, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // . 180 (0x80)
+		{ 0x80, 0x00, 0x00 }, { 0x40, 0x00, 0x00 }, { 0x20, 0x00, 0x00 }, { 0x10, 0x00, 0x00 },
+		{ 0x08, 0x00, 0x00 }, { 0x04, 0x00, 0x00 }, { 0x02, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	},
+	{ // . 270 (0x80)
+		{ 0x80, 0x00, 0x00 }, { 0x40, 0x00, 0x00 }, { 0x20, 0x00, 0x00 }, { 0x10, 0x00, 0x00 },
+		{ 0x08, 0x00, 0x00 }, { 0x04, 0x00, 0x00 }, { 0x02, 0x00, 0x00 }, { 0x01, 0x00, 0x00 }
+	}
+};
+
+// the right-most column in which every tetromino orientation still fits between the walls
+static const uint8_t tetrominoMaxX[8*4] PROGMEM =
+{
+	5, 7, 5, 7, // I
+	5, 6, 5, 6, // J
+	5, 6, 5, 6, // L
+	6, 6, 6, 6, // o
+	5, 6, 5, 6, // S
+	5, 6, 5, 6, // T
+	5, 6, 5, 6, // Z
+	7, 7, 7, 7  // .
+};
+
+#endif /* TETROMINO_MASKS_H_ */
@@ -0,0 +1,39 @@
+/*
+ * tetromino_profiles.h
+ *
+ * Column profiles used with the column heights when COLUMN_HEIGHTS is defined.
+ * Generated from tetrominos[] in main.c; regenerate them whenever a tetromino specification changes.
+ */
+
+
+#ifndef TETROMINO_PROFILES_H_
+#define TETROMINO_PROFILES_H_
+
+// 2 bits per column of the 3x3 box of every tetromino orientation (bits 0-1 are column 0): the row (0-2)
+// of the top-most block of the column, 3 when the column is empty
+static const uint8_t tetrominoTops[8*4] PROGMEM =
+{
+	0x00, 0x3C, 0x00, 0x3C, // I
+	0x00, 0x30, 0x14, 0x32, // J
+	0x00, 0x38, 0x05, 0x30, // L
+	0x30, 0x30, 0x30, 0x30, // o
+	0x01, 0x34, 0x01, 0x34, // S
+	0x00, 0x34, 0x11, 0x31, // T
+	0x10, 0x31, 0x10, 0x31, // Z
+	0x3C, 0x3C, 0x3C, 0x3C  // .
+};
+
+// the same for the bottom-most block of every column
+static const uint8_t tetrominoBottoms[8*4] PROGMEM =
+{
+	0x00, 0x3E, 0x00, 0x3E, // I
+	0x10, 0x32, 0x15, 0x3A, // J
+	0x01, 0x3A, 0x15, 0x38, // L
+	0x35, 0x35, 0x35, 0x35, // o
+	0x05, 0x39, 0x05, 0x39, // S
+	0x04, 0x36, 0x15, 0x39, // T
+	0x14, 0x36, 0x14, 0x36, // Z
+	0x3C, 0x3C, 0x3C, 0x3C  // .
+};
+
+#endif /* TETROMINO_PROFILES_H_ */